@@ -13,6 +13,219 @@
 #ifndef IMAGE_HPP
 #define IMAGE_HPP
 
+#include <algorithm>
+#include <typeinfo>
+#include <vector>
+#include <time.h>
+
+//------------------------------------------------------------------------------
+
+/// Type of the samples of all images. Define RAWK_FLOAT to evaluate images
+/// in single precision, which halves the memory traffic of sample caches and
+/// row buffers. Filters that accumulate many samples still sum in double.
+
+#ifdef RAWK_FLOAT
+typedef float  real;
+#else
+typedef double real;
+#endif
+
+//------------------------------------------------------------------------------
+
+/// Preview sample cache
+
+class memo
+{
+public:
+    /// Cache the samples of an image with the given *depth* taken at the pixels
+    /// of the preview grid. *Rows* and *columns* give the image row and column
+    /// sampled by each row and column of the grid, in increasing order. Grids
+    /// of more than *limit* samples are not stored. The grid position of each
+    /// image row and column spanned by the grid is tabulated, so that lookups
+    /// take constant time.
+
+    memo(const std::vector<int>& rows, const std::vector<int>& columns, int depth)
+        : rows(rows), columns(columns), depth(depth)
+    {
+        const size_t n = rows.size() * columns.size() * depth;
+
+        if (0 < n && n <= limit)
+        {
+            values.resize(n);
+            valid .resize(n, 0);
+
+            invert(rows,    row_at);
+            invert(columns, column_at);
+        }
+    }
+
+    /// Copy all samples of cache *that* that also fall on this grid.
+
+    void copy(const memo& that)
+    {
+        if (values.empty() || that.values.empty() || depth != that.depth)
+            return;
+
+        std::vector<int> r = remap(rows,    that.rows);
+        std::vector<int> c = remap(columns, that.columns);
+
+        for         (size_t a = 0; a < r.size(); ++a)
+            for     (size_t b = 0; b < c.size(); ++b)
+                if (r[a] >= 0 && c[b] >= 0)
+                    for (int k = 0; k < depth; ++k)
+                    {
+                        size_t m = (a    * columns.size()      + b)    * depth + k;
+                        size_t n = (r[a] * that.columns.size() + c[b]) * depth + k;
+
+                        values[m] = that.values[n];
+                        valid [m] = that.valid [n];
+                    }
+    }
+
+    /// Return true if this cache was built for the given grid and depth.
+
+    bool match(const std::vector<int>& r, const std::vector<int>& c, int d) const
+    {
+        return r == rows && c == columns && d == depth;
+    }
+
+    /// Return the index of sample (*i*, *j*, *k*) or -1 if it is off the grid.
+
+    int index(int i, int j, int k) const
+    {
+        if (0 <= k && k < depth && !values.empty())
+        {
+            const size_t a = size_t(i - rows   .front());
+            const size_t b = size_t(j - columns.front());
+
+            if (a < row_at.size() && b < column_at.size())
+            {
+                const int r = row_at   [a];
+                const int c = column_at[b];
+
+                if (r >= 0 && c >= 0)
+                    return (r * int(columns.size()) + c) * depth + k;
+            }
+        }
+        return -1;
+    }
+
+    /// Fetch cached sample *n* into *v*, returning false if it is not present.
+    /// Samples may be stored concurrently. A store always writes the same
+    /// value, so only the ordering of value and flag matters.
+
+    bool load(int n, real& v) const
+    {
+        if (valid[n])
+        {
+            #pragma omp flush
+            v = values[n];
+            return true;
+        }
+        return false;
+    }
+
+    void store(int n, real v)
+    {
+        values[n] = v;
+        #pragma omp flush
+        valid[n] = 1;
+    }
+
+    static const size_t limit = 1 << 25;
+
+private:
+    std::vector<int>    rows;
+    std::vector<int>    columns;
+    int                 depth;
+    std::vector<real>   values;
+    std::vector<char>   valid;
+    std::vector<int>    row_at;
+    std::vector<int>    column_at;
+
+    // Give the index in *v* of each value from its first to its last, or -1
+    // if absent.
+
+    static void invert(const std::vector<int>& v, std::vector<int>& m)
+    {
+        m.assign(size_t(v.back() - v.front()) + 1, -1);
+
+        for (size_t i = 0; i < v.size(); ++i)
+            m[v[i] - v.front()] = int(i);
+    }
+
+    // Give the index in *b* of each element of *a*, or -1 if absent.
+
+    static std::vector<int> remap(const std::vector<int>& a,
+                                  const std::vector<int>& b)
+    {
+        std::vector<int> v(a.size(), -1);
+
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            std::vector<int>::const_iterator j
+                = std::lower_bound(b.begin(), b.end(), a[i]);
+
+            if (j != b.end() && *j == a[i])
+                v[i] = int(j - b.begin());
+        }
+        return v;
+    }
+};
+
+//------------------------------------------------------------------------------
+
+/// Per-tile cost accounting
+
+class profile
+{
+public:
+    /// Account for the time spent and samples computed by an image over the
+    /// given number of preview *tiles*.
+
+    profile(int tiles) : time(tiles, 0.0), calls(tiles, 0) { }
+
+    void add(int t, double d)
+    {
+        #pragma omp atomic
+        time[t] += d;
+        #pragma omp atomic
+        calls[t] += 1;
+    }
+
+    /// Return the total time spent in all tiles.
+
+    double total_time() const
+    {
+        double d = 0;
+        for (size_t t = 0; t < time.size(); ++t)
+            d += time[t];
+        return d;
+    }
+
+    /// Return the total number of samples computed in all tiles.
+
+    long total_calls() const
+    {
+        long n = 0;
+        for (size_t t = 0; t < calls.size(); ++t)
+            n += calls[t];
+        return n;
+    }
+
+    std::vector<double> time;   ///< Seconds spent in each tile, less children
+    std::vector<long>   calls;  ///< Samples computed in each tile
+};
+
+/// Read a monotonic clock in seconds.
+
+static inline double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return double(t.tv_sec) + double(t.tv_nsec) * 1e-9;
+}
+
 //------------------------------------------------------------------------------
 
 /// Base class for all image sources, filters, and operators
@@ -23,7 +236,9 @@ public:
     /// Create a new image object with left child *L* and right child *R*.
     /// The parents of *L* and *R* are set to *this*.
 
-    image(image *L=0, image *R=0) : L(L), R(R), P(0)
+    image(image *L=0, image *R=0)
+        : L(L), R(R), P(0), M(0), C(0), dirty(false), changes(0),
+          depth(-1)
     {
         if (L) L->setP(this);
         if (R) R->setP(this);
@@ -33,13 +248,133 @@ public:
 
     virtual ~image()
     {
+        if (C) delete C;
+        if (M) delete M;
         if (R) delete R;
         if (L) delete L;
     }
 
     /// Return the value of the sample at row *i*, column *j*, channel *k*.
+    /// If this image is cached then the sample is sought there first. If this
+    /// image is instrumented and the calling thread is sampling a preview tile
+    /// then the time spent, less that spent by children, is charged to it.
+
+    real get(int i, int j, int k) const
+    {
+        if (C && tile >= 0)
+        {
+            const double s = spent;
+            const double t = now();
+
+            spent = 0;
+
+            real   v = fetch(i, j, k);
+            double d = now() - t;
+
+            C->add(tile, d - spent);
+            spent = s + d;
+
+            return v;
+        }
+        return fetch(i, j, k);
+    }
+
+    /// Return the value of the sample at row *i*, column *j*, channel *k*,
+    /// seeking it in the cache first.
+
+    real fetch(int i, int j, int k) const
+    {
+        int n;
+
+        if (M && (n = M->index(i, j, k)) >= 0)
+        {
+            real v;
+
+            if (!M->load(n, v))
+                M->store(n, v = eval(i, j, k));
+
+            return v;
+        }
+        return eval(i, j, k);
+    }
+
+    /// Return all get_depth() samples of the pixel at row *i*, column *j* in
+    /// *v*. Caching and cost accounting are as for get. Images whose channels
+    /// share upstream work compute them together.
+
+    void get_pixel(int i, int j, real *v) const
+    {
+        if (C && tile >= 0)
+        {
+            const double s = spent;
+            const double t = now();
+
+            spent = 0;
 
-    virtual double get(int i, int j, int k) const = 0;
+            fetch_pixel(i, j, v);
+            double d = now() - t;
+
+            C->add(tile, d - spent);
+            spent = s + d;
+        }
+        else fetch_pixel(i, j, v);
+    }
+
+    /// Return all samples of the pixel at row *i*, column *j* in *v*, seeking
+    /// them in the cache first. The samples of a pixel are adjacent there.
+
+    void fetch_pixel(int i, int j, real *v) const
+    {
+        const int d = channels();
+        int n;
+
+        if (M && (n = M->index(i, j, 0)) >= 0)
+        {
+            int k;
+
+            for (k = 0; k < d; ++k)
+                if (!M->load(n + k, v[k]))
+                    break;
+
+            if (k < d)
+            {
+                pixel(i, j, v);
+
+                for (k = 0; k < d; ++k)
+                    M->store(n + k, v[k]);
+            }
+        }
+        else pixel(i, j, v);
+    }
+
+    /// Compute all samples of the pixel at row *i*, column *j* into *v*. By
+    /// default, each channel is fetched separately. This is overridden by
+    /// images that would otherwise repeat upstream work for each channel.
+
+    virtual void pixel(int i, int j, real *v) const
+    {
+        const int d = channels();
+
+        for (int k = 0; k < d; ++k)
+            v[k] = fetch(i, j, k);
+    }
+
+    /// Return the samples of pixels *j0* through *j1* - 1 of row *i* in *v*,
+    /// pixel-interleaved. By default, each pixel is sampled with get_pixel.
+    /// This is overridden by images that can produce a run of pixels at once.
+
+    virtual void get_span(int i, int j0, int j1, real *v) const
+    {
+        const int d = channels();
+
+        for (int j = j0; j < j1; ++j, v += d)
+            get_pixel(i, j, v);
+    }
+
+    /// Compute the value of the sample at row *i*, column *j*, channel *k*.
+    /// This is implemented by each image object and called by get.
+
+    virtual real eval(int i, int j, int k) const = 0;
 
     /// Return the height of this image.
 
@@ -71,6 +406,14 @@ public:
         else        return 0;
     }
 
+    /// Return the depth of this image without walking the tree, once it has
+    /// been prepared. This is for use per pixel.
+
+    int channels() const
+    {
+        return (depth < 0) ? get_depth() : depth;
+    }
+
     /// Return the left child
 
     image *getL()
@@ -92,12 +435,146 @@ public:
         return P;
     }
 
+    /// Mark this image and all of its ancestors as modified. Their cached
+    /// samples, if any, will be discarded by the next call to recache.
+
+    void touch()
+    {
+        for (image *p = this; p; p = p->P)
+        {
+            p->dirty = true;
+            p->changes++;
+        }
+    }
+
+    /// Return the number of times this image or any of its descendants has
+    /// been modified. Images that retain results derived from a child compare
+    /// this count with its value when they were derived.
+
+    int get_changes() const
+    {
+        return changes;
+    }
+
+    /// Enable or disable the preview cache of this image. Enabling an enabled
+    /// cache retains its contents.
+
+    void cache(bool b)
+    {
+        if (b && !M) M = new memo(std::vector<int>(), std::vector<int>(), 0);
+        if (!b &&  M) { delete M; M = 0; }
+    }
+
+    /// Prepare the caches of this image and all of its descendants for the
+    /// preview grid given by *rows* and *columns*. Caches of modified images
+    /// are cleared. Caches built for a different grid retain the samples that
+    /// the two grids have in common. Modified flags are reset.
+
+    void recache(const std::vector<int>& rows, const std::vector<int>& columns)
+    {
+        if (M && (dirty || !M->match(rows, columns, get_depth())))
+        {
+            memo *m = new memo(rows, columns, get_depth());
+
+            if (!dirty) m->copy(*M);
+
+            delete M;
+            M = m;
+        }
+        dirty = false;
+
+        if (L) L->recache(rows, columns);
+        if (R) R->recache(rows, columns);
+    }
+
+    /// Enable cost accounting over the given number of preview *tiles* for
+    /// this image and all of its descendants, discarding any prior accounting.
+    /// Zero tiles disables it.
+
+    void instrument(int tiles)
+    {
+        if (C) delete C;
+        C = tiles ? new profile(tiles) : 0;
+
+        if (L) L->instrument(tiles);
+        if (R) R->instrument(tiles);
+    }
+
+    /// Return the cost accounting of this image, if any.
+
+    const profile *get_profile() const
+    {
+        return C;
+    }
+
+    /// Disable the preview caches of this image and all of its descendants.
+
+    void uncache()
+    {
+        cache(false);
+
+        if (L) L->uncache();
+        if (R) R->uncache();
+    }
+
+    /// Advise the sources of this image that rows *i0* through *i1* - 1 and
+    /// columns *j0* through *j1* - 1 of it will soon be sampled.
+
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        if (L) L->advise(i0, j0, i1, j1);
+        if (R) R->advise(i0, j0, i1, j1);
+    }
+
+    /// Return the radius in pixels of the neighborhood of this image that
+    /// contributes to each of its samples, as measured in its own pixels.
+
+    virtual int footprint() const
+    {
+        return std::max(L ? L->footprint() : 0,
+                        R ? R->footprint() : 0);
+    }
+
+    /// Is each sample of this image an unmodified sample of a RAW file of type
+    /// *t*, or zero? This holds for an ::input of that type and for purely
+    /// geometric operations upon such images, whose samples may then be
+    /// copied as bytes rather than converted.
+
+    virtual bool copies(const std::type_info& t) const
+    {
+        return false;
+    }
+
+    /// Locate sample *i*, *j*, *k* of an image that #copies. Return the file
+    /// holding it and set *i*, *j*, *k* to its position there, or return null
+    /// if the sample is zero. Reduce *n* so that the *n* samples of channel *k*
+    /// beginning at column *j* lie in successive columns of that file, or are
+    /// all zero.
+
+    virtual const raw *locate(int& i, int& j, int& k, int& n) const
+    {
+        return 0;
+    }
+
     /// Tweak image parameter *a*, changing the value by a factor of *v*.
 
     virtual void tweak(int a, int v)
     {
     }
 
+    /// Make any pass over the whole of the children that this image and its
+    /// descendants need before they are sampled. This is called with no
+    /// sampling under way and outside of any parallel region, before each
+    /// preview refresh or benchmark, so that such passes may run in parallel.
+
+    virtual void prepare()
+    {
+        if (L) L->prepare();
+        if (R) R->prepare();
+
+        depth = get_depth();
+    }
+
     /// Process all samples of both children.
 
     virtual void process()
@@ -117,11 +594,26 @@ protected:
     image *L;    ///< Left child
     image *R;    ///< Right child
     image *P;    ///< Parent
+    memo  *M;    ///< Preview sample cache
+    profile *C;  ///< Cost accounting
+
+    bool dirty;    ///< Modified since the last recache?
+    int  changes;  ///< Modifications of this image and its descendants
+    int  depth;    ///< Depth found by the last prepare, or -1
+
+public:
+    static int    tile;   ///< Preview tile sampled by this thread, or -1
+    static double spent;  ///< Time spent by children of the current sample
+
+    #pragma omp threadprivate(tile, spent)
 
 private:
     void setP(image *p) { P = p; }
 };
 
+int    image::tile  = -1;
+double image::spent =  0;
+
 //------------------------------------------------------------------------------
 
 static inline int mod(int a, int n)
@@ -136,6 +628,23 @@ static inline int wrap(int i, int n, bool w)
     else                return i;
 }
 
+/// Wrap coordinate *i* as above only if *B*, that is, only where it may fall
+/// beyond the border. Neighborhood filters instantiate their inner loops both
+/// ways, so that the interior of the image is sampled with no wrapping.
+
+template <bool B> static inline int wrap(int i, int n, bool w)
+{
+    return B ? wrap(i, n, w) : i;
+}
+
+/// Does the neighborhood of *r* rows and *s* columns about pixel *i*, *j* lie
+/// wholly within an image of height *h* and width *w*?
+
+static inline bool inside(int i, int j, int r, int s, int h, int w)
+{
+    return r <= i && i < h - r && s <= j && j < w - s;
+}
+
 //------------------------------------------------------------------------------
 
 #endif
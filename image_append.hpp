@@ -28,7 +28,7 @@ public:
 
     append(image *L, image *R) : image(L, R) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const int d = L->get_depth();
 
@@ -38,6 +38,27 @@ public:
             return R->get(i, j, k - d);
     }
 
+    virtual void pixel(int i, int j, real *v) const
+    {
+        L->get_pixel(i, j, v);
+        R->get_pixel(i, j, v + L->channels());
+    }
+
+    virtual bool copies(const std::type_info& t) const
+    {
+        return L->copies(t) && R->copies(t);
+    }
+
+    virtual const raw *locate(int& i, int& j, int& k, int& n) const
+    {
+        const int d = L->get_depth();
+
+        if (k < d)
+            return L->locate(i, j, k, n);
+        else
+            return R->locate(i, j, k -= d, n);
+    }
+
     virtual int get_depth() const
     {
         return L->get_depth() + R->get_depth();
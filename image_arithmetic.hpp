@@ -26,7 +26,7 @@ public:
 
     sum(image *L, image *R) : image(L, R) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return L->get(i, j, k)
              + R->get(i, j, k);
@@ -51,7 +51,7 @@ public:
 
     difference(image *L, image *R) : image(L, R) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return L->get(i, j, k)
              - R->get(i, j, k);
@@ -77,7 +77,7 @@ public:
 
     multiply(image *L, image *R) : image(L, R) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         if (double v = L->get(i, j, k))
             return v * R->get(i, j, k);
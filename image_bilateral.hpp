@@ -0,0 +1,421 @@
+// RAWK Copyright (C) 2014 Robert Kooima
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef IMAGE_BILATERAL_HPP
+#define IMAGE_BILATERAL_HPP
+
+//------------------------------------------------------------------------------
+
+/// Bilateral filter
+
+class bilateral : public image
+{
+public:
+    /// Smooth each channel of image *L* while preserving its edges, by
+    /// averaging over a spatial neighborhood of scale *sigma_s* pixels and
+    /// sample values within *sigma_r* of each other. This removes noise from
+    /// elevation models without smearing features such as crater rims.
+    ///
+    /// The filter is approximated using a bilateral grid: each sample is
+    /// splatted into a three-dimensional grid with cells *sigma_s* pixels wide
+    /// and *sigma_r* deep, the grid is blurred, and the result is sliced back
+    /// out by trilinear interpolation. The cost per sample is nearly
+    /// independent of *sigma_s*. The image is filtered in square tiles, each
+    /// with a small grid of its own that is retained by the thread that built
+    /// it. Grid cells are aligned with the image, not the tile, so tiles join
+    /// seamlessly. The range cells of a tile whose values span too many
+    /// multiples of *sigma_r* are widened to bound the size of its grid.
+
+    bilateral(double sigma_s, double sigma_r, image *L)
+        : image(L),
+          sigma_s(std::max(1.0,  sigma_s)),
+          sigma_r(std::max(1e-6, sigma_r)),
+          id    (++serials),
+          serial(id),
+          seen  (-1)
+    {
+        size = 64;
+
+        while (size < 32 * this->sigma_s && size < 1024)
+            size *= 2;
+    }
+
+    /// Release the grids of this filter retained by each thread of the team.
+
+    virtual ~bilateral()
+    {
+        #pragma omp parallel
+        discard(false);
+    }
+
+    virtual real eval(int i, int j, int k) const
+    {
+        if (0 <= i && i < L->get_height() &&
+            0 <= j && j < L->get_width () &&
+            0 <= k && k < L->get_depth ())
+        {
+            const real v = L->get(i, j, k);
+
+            return find(i / size, j / size)->slice(i / sigma_s,
+                                                   j / sigma_s, k, v);
+        }
+        return 0.0;
+    }
+
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        const int m = margin();
+
+        L->advise(floor_div(i0, size) * size - m,
+                  floor_div(j0, size) * size - m,
+                  floor_div(i1 + size - 1, size) * size + m,
+                  floor_div(j1 + size - 1, size) * size + m);
+    }
+
+    virtual int footprint() const
+    {
+        return L->footprint() + size + margin();
+    }
+
+    /// Retire the grids built before any image below this one was modified.
+
+    virtual void prepare()
+    {
+        image::prepare();
+
+        if (seen != L->get_changes())
+        {
+            seen   = L->get_changes();
+            serial = ++serials;
+        }
+    }
+
+    virtual void tweak(int a, int v)
+    {
+        if (a == 0)
+        {
+            sigma_r = std::max(0.01, sigma_r + 0.01 * v);
+            serial  = ++serials;
+        }
+    }
+
+    virtual void doc(std::ostream& out) const
+    {
+        out << "bilateral " << sigma_s << " " << sigma_r;
+    }
+
+private:
+    double sigma_s;
+    double sigma_r;
+    int    size;
+    long   id;       ///< Serial number of this filter
+    long   serial;   ///< Serial number of its latest parameters and source
+    int    seen;     ///< Modification count of L at the latest serial
+
+    /// The bilateral grid of one tile. Each cell holds the sum of the samples
+    /// splatted into it and their count, blurred.
+
+    struct grid
+    {
+        long id;       ///< Serial number of the filter that built the grid
+        long serial;   ///< Serial number of the parameters it was built with
+        int  a;        ///< Tile row
+        int  b;        ///< Tile column
+        int  y0;       ///< First grid row
+        int  x0;       ///< First grid column
+        int  ny;       ///< Number of grid rows
+        int  nx;       ///< Number of grid columns
+
+        std::vector<double> sr;    ///< Range cell depth of each channel
+        std::vector<int>    r0;    ///< First range cell of each channel
+        std::vector<int>    nr;    ///< Number of range cells of each channel
+        std::vector<size_t> base;  ///< Offset of each channel in data
+        std::vector<float>  data;
+
+        /// Return the cell value interpolated at grid row *y* and column *x*
+        /// for sample value *v* of channel *k*, or *v* if no samples fall near
+        /// it.
+
+        double slice(double y, double x, int k, double v) const
+        {
+            const double fy = y - y0;
+            const double fx = x - x0;
+            const double fr = v / sr[k] - r0[k];
+
+            const int iy = std::max(0, std::min(ny    - 2, int(floor(fy))));
+            const int ix = std::max(0, std::min(nx    - 2, int(floor(fx))));
+            const int ir = std::max(0, std::min(nr[k] - 2, int(floor(fr))));
+
+            const double ty = fy - iy;
+            const double tx = fx - ix;
+            const double tr = fr - ir;
+
+            const float *p = &data[base[k]];
+
+            double s = 0;
+            double c = 0;
+
+            for         (int dy = 0; dy < 2; ++dy)
+                for     (int dx = 0; dx < 2; ++dx)
+                    for (int dr = 0; dr < 2; ++dr)
+                    {
+                        const double u = (dy ? ty : 1 - ty)
+                                       * (dx ? tx : 1 - tx)
+                                       * (dr ? tr : 1 - tr);
+                        const float *q = p + (((iy + dy) * nx + (ix + dx))
+                                                  * nr[k] + (ir + dr)) * 2;
+                        s += u * q[0];
+                        c += u * q[1];
+                    }
+
+            return (c > 1e-6) ? s / c : v;
+        }
+    };
+
+    /// Return the number of pixels beyond a tile that contribute to its grid.
+
+    int margin() const
+    {
+        return int(ceil(3 * sigma_s)) + 1;
+    }
+
+    /// Return the grid of tile *a*, *b*, building it if it is not among those
+    /// retained by the calling thread. Grids are retained most recently used
+    /// first, and the least recently used is rebuilt when all slots are full.
+
+    const grid *find(int a, int b) const
+    {
+        std::vector<grid *>& c = grids();
+
+        for (size_t n = 0; n < c.size(); ++n)
+            if (c[n]->id == id && c[n]->serial == serial && c[n]->a == a
+                                                         && c[n]->b == b)
+            {
+                if (n) std::rotate(c.begin(), c.begin() + n, c.begin() + n + 1);
+                return c.front();
+            }
+
+        discard(true);
+
+        grid *g;
+
+        if (c.size() < slots)
+            g = new grid;
+        else
+        {
+            g = c.back();
+            c.pop_back();
+        }
+        build(*g, a, b);
+
+        c.insert(c.begin(), g);
+        return g;
+    }
+
+    /// Delete the grids of this filter retained by the calling thread, or
+    /// only those built before its latest tweak if *stale*.
+
+    void discard(bool stale) const
+    {
+        std::vector<grid *>& c = grids();
+
+        for (size_t n = 0; n < c.size(); )
+            if (c[n]->id == id && (c[n]->serial != serial || !stale))
+            {
+                delete c[n];
+                c.erase(c.begin() + n);
+            }
+            else n++;
+    }
+
+    /// Splat the pixels near tile *a*, *b* into grid *g* and blur it.
+
+    void build(grid& g, int a, int b) const
+    {
+        const int h = L->get_height();
+        const int w = L->get_width ();
+        const int d = L->get_depth ();
+
+        const int i0 = a * size, i1 = std::min(h, i0 + size);
+        const int j0 = b * size, j1 = std::min(w, j0 + size);
+
+        // Cover the cells interpolated within the tile, and their neighbors.
+
+        g.id     = id;
+        g.serial = serial;
+        g.a      = a;
+        g.b      = b;
+        g.y0     = int(floor(i0 / sigma_s)) - 1;
+        g.x0     = int(floor(j0 / sigma_s)) - 1;
+        g.ny     = int(floor((i1 - 1) / sigma_s)) + 3 - g.y0;
+        g.nx     = int(floor((j1 - 1) / sigma_s)) + 3 - g.x0;
+
+        // Gather the pixels that round to those cells.
+
+        const int pi0 = std::max(0, int(ceil((g.y0           - 0.5) * sigma_s)));
+        const int pi1 = std::min(h, int(ceil((g.y0 + g.ny    - 0.5) * sigma_s)));
+        const int pj0 = std::max(0, int(ceil((g.x0           - 0.5) * sigma_s)));
+        const int pj1 = std::min(w, int(ceil((g.x0 + g.nx    - 0.5) * sigma_s)));
+        const int pw  = pj1 - pj0;
+
+        std::vector<real> v(size_t(pi1 - pi0) * pw * d);
+
+        for     (int i = pi0; i < pi1; ++i)
+            for (int j = pj0; j < pj1; ++j)
+                L->get_pixel(i, j, &v[(size_t(i - pi0) * pw + (j - pj0)) * d]);
+
+        // Size the range axis of each channel to its values, widening the
+        // range cells if there would be too many.
+
+        const int most = std::max(8, int(cells / (size_t(g.ny) * g.nx)));
+
+        g.sr  .resize(d);
+        g.r0  .resize(d);
+        g.nr  .resize(d);
+        g.base.resize(d);
+
+        size_t n = 0;
+
+        for (int k = 0; k < d; ++k)
+        {
+            real lo =  std::numeric_limits<real>::max();
+            real hi = -std::numeric_limits<real>::max();
+
+            for (size_t m = k; m < v.size(); m += d)
+            {
+                lo = std::min(lo, v[m]);
+                hi = std::max(hi, v[m]);
+            }
+            if (lo > hi) lo = hi = 0;
+
+            g.sr  [k] = std::max(sigma_r, double(hi - lo) / (most - 5));
+            g.r0  [k] = int(floor(lo / g.sr[k])) - 1;
+            g.nr  [k] = int(floor(hi / g.sr[k])) + 3 - g.r0[k];
+            g.base[k] = n;
+
+            n += size_t(g.ny) * g.nx * g.nr[k] * 2;
+        }
+        g.data.assign(n, 0.0f);
+
+        // Splat each sample into its nearest cell.
+
+        for     (int i = pi0; i < pi1; ++i)
+            for (int j = pj0; j < pj1; ++j)
+            {
+                const int y = int(floor(i / sigma_s + 0.5)) - g.y0;
+                const int x = int(floor(j / sigma_s + 0.5)) - g.x0;
+
+                const real *p = &v[(size_t(i - pi0) * pw + (j - pj0)) * d];
+
+                for (int k = 0; k < d; ++k)
+                {
+                    const int r = int(floor(p[k] / g.sr[k] + 0.5)) - g.r0[k];
+
+                    float *q = &g.data[g.base[k] + ((size_t(y) * g.nx + x)
+                                                       * g.nr[k] + r) * 2];
+                    q[0] += float(p[k]);
+                    q[1] += 1.0f;
+                }
+            }
+
+        // Blur each channel along each axis.
+
+        for (int k = 0; k < d; ++k)
+        {
+            float *p = &g.data[g.base[k]];
+
+            blur(p, 1,           g.ny,    g.nx * g.nr[k] * 2);
+            blur(p, g.ny,        g.nx,           g.nr[k] * 2);
+            blur(p, g.ny * g.nx, g.nr[k],                  2);
+        }
+    }
+
+    /// Blur array *p*, of *n0* by *n1* by *n2* floats, along its middle axis
+    /// with the kernel [1 2 1] / 4.
+
+    static void blur(float *p, int n0, int n1, int n2)
+    {
+        std::vector<float> prev(n2);
+        std::vector<float> curr(n2);
+
+        for (int a = 0; a < n0; ++a)
+        {
+            float *q = p + size_t(a) * n1 * n2;
+
+            std::fill(prev.begin(), prev.end(), 0.0f);
+
+            for (int m = 0; m < n1; ++m)
+            {
+                float *r = q + size_t(m) * n2;
+
+                std::copy(r, r + n2, curr.begin());
+
+                for (int c = 0; c < n2; ++c)
+                    r[c] = 0.25f * (prev[c] + 2 * curr[c]
+                                  + ((m + 1 < n1) ? r[c + n2] : 0.0f));
+
+                prev.swap(curr);
+            }
+        }
+    }
+
+    static int floor_div(int a, int b)
+    {
+        return (a < 0) ? -((-a + b - 1) / b) : a / b;
+    }
+
+    static const size_t slots = 20;        ///< Grids retained per thread
+    static const size_t cells = 1 << 18;   ///< Most cells per grid channel
+
+    static long serials;                   ///< Latest serial number
+
+    /// Grids retained by each thread, of any filter. These are reached through
+    /// a thread-specific key, so that the grids of a thread are deleted when
+    /// it exits.
+
+    static pthread_key_t  cache;
+    static pthread_once_t cache_once;
+
+    static void cache_create()
+    {
+        pthread_key_create(&cache, cache_delete);
+    }
+    static void cache_delete(void *p)
+    {
+        std::vector<grid *> *c = (std::vector<grid *> *) p;
+
+        for (size_t n = 0; n < c->size(); ++n)
+            delete (*c)[n];
+
+        delete c;
+    }
+
+    static std::vector<grid *>& grids()
+    {
+        pthread_once(&cache_once, cache_create);
+
+        std::vector<grid *> *c = (std::vector<grid *> *)
+                                     pthread_getspecific(cache);
+        if (c == 0)
+            pthread_setspecific(cache, c = new std::vector<grid *>());
+
+        return *c;
+    }
+};
+
+long           bilateral::serials    = 0;
+pthread_key_t  bilateral::cache;
+pthread_once_t bilateral::cache_once = PTHREAD_ONCE_INIT;
+
+//------------------------------------------------------------------------------
+
+#endif
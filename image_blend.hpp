@@ -28,7 +28,7 @@ public:
 
     blend(image *L, image *R) : image(L, R) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         double a = L->get(i, j, L->get_depth() - 1);
 
@@ -38,6 +38,48 @@ public:
         return a * L->get(i, j, k) + (1.0 - a) * R->get(i, j, k);
     }
 
+    virtual void pixel(int i, int j, real *v) const
+    {
+        const int d  = channels();
+        const int dl = L->channels();
+        const int dr = R->channels();
+
+        real l[36];
+        real r[36];
+
+        // Wider inputs are fetched a channel at a time.
+
+        if (dl > 36 || dr > 36)
+        {
+            image::pixel(i, j, v);
+            return;
+        }
+
+        L->get_pixel(i, j, l);
+
+        const double a = l[dl - 1];
+
+        if (a != 1.0)
+            R->get_pixel(i, j, r);
+
+        for (int k = 0; k < d; ++k)
+        {
+            const double lk = (k < dl) ? l[k] : L->get(i, j, k);
+
+            if (a == 1.0)
+                v[k] = lk;
+            else
+            {
+                const double rk = (k < dr) ? r[k] : R->get(i, j, k);
+
+                if (a == 0.0)
+                    v[k] = rk;
+                else
+                    v[k] = a * lk + (1.0 - a) * rk;
+            }
+        }
+    }
+
     virtual int get_depth() const
     {
         return std::max(L->get_depth() - 1, R->get_depth());
@@ -26,11 +26,17 @@ public:
 
     choose(int which, image *L, image *R) : image(L, R), which(which) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return which ? R->get(i, j, k) : L->get(i, j, k);
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        if (which) R->advise(i0, j0, i1, j1);
+        else       L->advise(i0, j0, i1, j1);
+    }
+
     virtual void tweak(int a, int v)
     {
         if (a == 0) which += v;
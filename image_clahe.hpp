@@ -0,0 +1,246 @@
+// RAWK Copyright (C) 2014 Robert Kooima
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef IMAGE_CLAHE_HPP
+#define IMAGE_CLAHE_HPP
+
+//------------------------------------------------------------------------------
+
+/// Contrast-limited adaptive histogram equalization filter
+
+class clahe : public image
+{
+public:
+    /// Enhance the local contrast of image *L* by dividing it into a grid of
+    /// *tiles* by *tiles* rectangles and equalizing the histogram of each. The
+    /// histogram of a tile is clipped at *clip* times its mean bin count, and
+    /// the excess spread evenly over all bins, limiting the amplification of
+    /// noise in flat regions. A *clip* of zero gives unlimited equalization.
+    /// Each sample is mapped by bilinear interpolation of the cumulative
+    /// distributions of the four tiles nearest it, so that tile boundaries do
+    /// not show. Samples are taken to lie in the range [0,1].
+    ///
+    /// The tile histograms are found by a pass over all of *L*, made when this
+    /// image is processed or prepared for preview, and found again after any
+    /// image below this one is modified. A tweak of *clip* redoes only the
+    /// equalization, at the next preparation.
+
+    clahe(int tiles, double clip, image *L)
+        : image(L), tiles(std::max(1, tiles)), clip(clip), ready(false), seen(-1) { }
+
+    virtual real eval(int i, int j, int k) const
+    {
+        const int h = L->get_height();
+        const int w = L->get_width ();
+        const int d = L->get_depth ();
+
+        // Find the four tiles whose centers surround this pixel.
+
+        const double y = (i + 0.5) * tiles / h - 0.5;
+        const double x = (j + 0.5) * tiles / w - 0.5;
+
+        const int    a = std::max(0, std::min(tiles - 1, int(floor(y))));
+        const int    b = std::max(0, std::min(tiles - 1, int(floor(x))));
+        const int    c = std::min(tiles - 1, a + 1);
+        const int    e = std::min(tiles - 1, b + 1);
+        const double s = std::max(0.0, std::min(1.0, y - a));
+        const double t = std::max(0.0, std::min(1.0, x - b));
+
+        // Locate the sample within its histogram bin.
+
+        const double v = std::max(0.0, std::min(1.0, double(L->get(i, j, k))));
+        const double p = v * bins;
+        const int    n = std::min(bins - 1, int(p));
+        const double f = p - n;
+
+        const double aa = lookup(a, b, k, d, n, f);
+        const double ab = lookup(a, e, k, d, n, f);
+        const double ca = lookup(c, b, k, d, n, f);
+        const double cb = lookup(c, e, k, d, n, f);
+
+        return (aa * (1 - t) + ab * t) * (1 - s)
+             + (ca * (1 - t) + cb * t) * s;
+    }
+
+    virtual void prepare()
+    {
+        image::prepare();
+
+        if (seen != L->get_changes())
+        {
+            hist.clear();
+            ready = false;
+            seen  = L->get_changes();
+        }
+
+        if (!ready)
+        {
+            analyze();
+            ready = true;
+        }
+    }
+
+    virtual void process()
+    {
+        image::process();
+        prepare();
+    }
+
+    virtual void tweak(int a, int v)
+    {
+        if (a == 0)
+        {
+            clip  = std::max(0.0, clip + 0.1 * v);
+            ready = false;
+        }
+    }
+
+    virtual void doc(std::ostream& out) const
+    {
+        out << "clahe " << tiles << " " << clip;
+    }
+
+private:
+    static const int bins = 256;
+
+    int    tiles;
+    double clip;
+
+    bool ready;
+    int  seen;  ///< Modification count of L when the histograms were found
+
+    // Histogram counts and cumulative distributions of each channel of each
+    // tile, in row-major tile order.
+
+    std::vector<long long> hist;
+    std::vector<float>     cdf;
+
+    /// Return the cumulative distribution of tile *a*, *b* in channel *k* at
+    /// fraction *f* of the way through bin *n*.
+
+    double lookup(int a, int b, int k, int d, int n, double f) const
+    {
+        const float *C = &cdf[((size_t(a) * tiles + b) * d + k) * bins];
+        const double z = n ? C[n - 1] : 0.0;
+
+        return z + f * (C[n] - z);
+    }
+
+    /// Accumulate the histogram of each tile, a row of tiles at a time, and
+    /// advise each row of tiles while the one before it is scanned. Rows of
+    /// pixels are divided among threads, each accumulating its own counts for
+    /// the row of tiles, and these are summed exactly.
+
+    void analyze()
+    {
+        const int h = L->get_height();
+        const int w = L->get_width ();
+        const int d = L->get_depth ();
+        const int m = tiles * d * bins;
+
+        if (hist.empty())
+        {
+            hist.assign(size_t(tiles) * m, 0);
+
+            L->advise(0, 0, top(1, h), w);
+
+            for (int r = 0; r < tiles; ++r)
+            {
+                const int i0 = top(r,     h);
+                const int i1 = top(r + 1, h);
+
+                L->advise(i1, 0, top(r + 2, h), w);
+
+                long long *H = &hist[size_t(r) * m];
+
+                #pragma omp parallel
+                {
+                    std::vector<long long> part(m, 0);
+                    std::vector<real>      x(d);
+
+                    #pragma omp for schedule(dynamic)
+                    for (int i = i0; i < i1; ++i)
+                        for (int j = 0; j < w; ++j)
+                        {
+                            const int c = std::min(tiles - 1, int(double(j) * tiles / w));
+
+                            L->get_pixel(i, j, &x.front());
+
+                            for (int k = 0; k < d; ++k)
+                            {
+                                const double v = std::max(0.0, std::min(1.0, double(x[k])));
+                                const int    n = std::min(bins - 1, int(v * bins));
+
+                                part[(c * d + k) * bins + n]++;
+                            }
+                        }
+
+                    #pragma omp critical (clahe_merge)
+                    for (int k = 0; k < m; ++k)
+                        H[k] += part[k];
+                }
+            }
+        }
+        equalize();
+    }
+
+    /// Clip each tile histogram and form its cumulative distribution.
+
+    void equalize()
+    {
+        const int n = tiles * tiles * L->get_depth();
+
+        cdf.resize(size_t(n) * bins);
+
+        #pragma omp parallel for
+        for (int t = 0; t < n; ++t)
+        {
+            std::vector<double> H(hist.begin() + size_t(t) * bins,
+                                  hist.begin() + size_t(t) * bins + bins);
+
+            const double total = std::accumulate(H.begin(), H.end(), 0.0);
+
+            if (clip > 0)
+            {
+                const double limit = std::max(1.0, clip * total / bins);
+
+                double excess = 0;
+
+                for (int b = 0; b < bins; ++b)
+                    if (H[b] > limit)
+                    {
+                        excess += H[b] - limit;
+                        H[b]    = limit;
+                    }
+                for (int b = 0; b < bins; ++b)
+                    H[b] += excess / bins;
+            }
+
+            double c = 0;
+
+            for (int b = 0; b < bins; ++b)
+                cdf[size_t(t) * bins + b] = float(total > 0 ? (c += H[b]) / total
+                                                            : (b + 1.0) / bins);
+        }
+    }
+
+    /// Return the first row of tile row *r* of an image of height *h*.
+
+    int top(int r, int h) const
+    {
+        return int((long long) std::min(r, tiles) * h / tiles);
+    }
+};
+
+//------------------------------------------------------------------------------
+
+#endif
@@ -26,11 +26,35 @@ public:
     convolve(int yradius, int xradius, int mode, image *L)
         : image(L), yradius(yradius), xradius(xradius), mode(mode) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const int h = L->get_height();
         const int w = L->get_width ();
 
+        if (inside(i, j, yradius, xradius, h, w))
+            return sum<false>(i, j, k, h, w);
+        else
+            return sum<true >(i, j, k, h, w);
+    }
+
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 - yradius, j0 - xradius, i1 + yradius, j1 + xradius);
+    }
+
+    virtual int footprint() const
+    {
+        return L->footprint() + std::max(yradius, xradius);
+    }
+
+protected:
+    virtual double kernel(int, int) const = 0;
+
+    /// Convolve about pixel *i*, *j* of *L*, of height *h* and width *w*,
+    /// wrapping the coordinates of each tap only if *B*.
+
+    template <bool B> double sum(int i, int j, int k, int h, int w) const
+    {
         double s = 0;
         double t = 0;
         double T = 0;
@@ -40,16 +64,13 @@ public:
                 if ((s = kernel(y, x)))
                 {
                     T += s;
-                    t += s * L->get(wrap(i + y, h, mode & 1),
-                                    wrap(j + x, w, mode & 2), k);
+                    t += s * L->get(wrap<B>(i + y, h, mode & 1),
+                                    wrap<B>(j + x, w, mode & 2), k);
                 }
 
         return t / T;
     }
 
-protected:
-    virtual double kernel(int, int) const = 0;
-
     int yradius;
     int xradius;
     int mode;
@@ -26,7 +26,7 @@ public:
     crop(int row, int column, int height, int width, image *L)
         : image(L), row(row), column(column), height(height), width(width) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         if (0 <= i && i < height &&
             0 <= j && j < width)
@@ -36,6 +36,37 @@ public:
             return 0.0;
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        i0 = std::max(i0, 0);
+        j0 = std::max(j0, 0);
+        i1 = std::min(i1, height);
+        j1 = std::min(j1, width);
+
+        if (i0 < i1 && j0 < j1)
+            L->advise(i0 + row, j0 + column, i1 + row, j1 + column);
+    }
+
+    virtual bool copies(const std::type_info& t) const
+    {
+        return L->copies(t);
+    }
+
+    virtual const raw *locate(int& i, int& j, int& k, int& n) const
+    {
+        if (0 <= i && i < height &&
+            0 <= j && j < width)
+        {
+            n = std::min(n, width - j);
+            return L->locate(i += row, j += column, k, n);
+        }
+        else
+        {
+            if (j < 0) n = std::min(n, -j);
+            return 0;
+        }
+    }
+
     virtual int get_height() const { return height; }
     virtual int get_width () const { return width;  }
 
@@ -0,0 +1,271 @@
+// RAWK Copyright (C) 2014 Robert Kooima
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef IMAGE_DISTANCE_HPP
+#define IMAGE_DISTANCE_HPP
+
+//------------------------------------------------------------------------------
+
+/// Euclidean distance transform
+
+class distance : public image
+{
+public:
+    /// Find the Euclidean distance, in pixels, from each pixel to the nearest
+    /// nonzero pixel of each channel of image *L*, such as the output of a
+    /// ::threshold, wrapped with the given @ref wrap "wrapping mode". A wrapped
+    /// image is taken to be periodic, so mode 2 gives correct distances across
+    /// the seam of a global map. This is useful for feathering mosaics and for
+    /// finding voids and buffer zones. Channels without nonzero pixels give the
+    /// length of the diagonal of the image, which exceeds any distance within
+    /// it, so that no infinity reaches the images above.
+    ///
+    /// The exact transform of Felzenszwalb and Huttenlocher is found by a pass
+    /// down the columns and then a pass along the rows, each in parallel and
+    /// in linear time. It is made when this image is processed or prepared for
+    /// preview, and made again after any image below this one is modified.
+    /// Unlike most images, this one is computed in core: all of it is retained
+    /// in memory as single precision floats, so four bytes per sample of *L*
+    /// must fit in RAM.
+
+    distance(int mode, image *L) : image(L), mode(mode), seen(-1) { }
+
+    virtual real eval(int i, int j, int k) const
+    {
+        const int h = L->get_height();
+        const int w = L->get_width ();
+        const int d = L->get_depth ();
+
+        if (0 <= i && i < h && 0 <= j && j < w && 0 <= k && k < d)
+            return D[(size_t(i) * w + j) * d + k];
+        else
+            return 0.0;
+    }
+
+    virtual void advise(int, int, int, int) const
+    {
+    }
+
+    virtual int footprint() const
+    {
+        return 0;
+    }
+
+    virtual void prepare()
+    {
+        image::prepare();
+
+        if (seen != L->get_changes())
+        {
+            analyze();
+            seen = L->get_changes();
+        }
+    }
+
+    virtual void process()
+    {
+        image::process();
+        prepare();
+    }
+
+    virtual void doc(std::ostream& out) const
+    {
+        out << "distance " << mode;
+    }
+
+private:
+    int mode;
+
+    int seen;  ///< Modification count of L at the last transform
+
+    std::vector<float> D;
+
+    void analyze()
+    {
+        const int h = L->get_height();
+        const int w = L->get_width ();
+        const int d = L->get_depth ();
+
+        D.resize(size_t(h) * w * d);
+
+        // Read the sites a band at a time, advising each band while the band
+        // before it is read.
+
+        const int b = std::max(1, 16 * omp_get_max_threads());
+
+        L->advise(0, 0, std::min(b, h), w);
+
+        for (int i0 = 0; i0 < h; i0 += b)
+        {
+            const int i1 = std::min(i0 + b, h);
+
+            L->advise(i1, 0, std::min(i1 + b, h), w);
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int i = i0; i < i1; ++i)
+            {
+                std::vector<real> v(d);
+
+                for (int j = 0; j < w; ++j)
+                {
+                    L->get_pixel(i, j, &v.front());
+
+                    for (int k = 0; k < d; ++k)
+                        D[(size_t(i) * w + j) * d + k] = v[k] ? 0.0f : far;
+                }
+            }
+        }
+
+        // Transform the columns in groups of adjacent samples, so that each
+        // row of the group is read and written in one piece, and then the
+        // rows.
+
+        const int n = w * d;
+        const int g = 16;
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int c = 0; c < n; c += g)
+        {
+            const int e = std::min(g, n - c);
+
+            std::vector<double> f(size_t(e) * h);
+            line l(h, mode & 1);
+
+            for     (int i = 0; i < h; ++i)
+                for (int m = 0; m < e; ++m)
+                    f[size_t(m) * h + i] = D[size_t(i) * n + c + m];
+
+            for (int m = 0; m < e; ++m)
+                l.transform(&f[size_t(m) * h]);
+
+            for     (int i = 0; i < h; ++i)
+                for (int m = 0; m < e; ++m)
+                    D[size_t(i) * n + c + m] = float(f[size_t(m) * h + i]);
+        }
+
+        const double top = double(h) * h + double(w) * w;
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < h; ++i)
+        {
+            std::vector<double> f(w);
+            line l(w, mode & 2);
+
+            for (int k = 0; k < d; ++k)
+            {
+                float *p = &D[size_t(i) * n + k];
+
+                for (int j = 0; j < w; ++j)
+                    f[j] = p[size_t(j) * d];
+
+                l.transform(&f.front());
+
+                for (int j = 0; j < w; ++j)
+                    p[size_t(j) * d] = float(sqrt(std::min(f[j], top)));
+            }
+        }
+    }
+
+    /// The squared distance of a pixel with no site.
+
+    static const float far;
+
+    /// One-dimensional squared distance transform of a line of *n* samples.
+    /// A wrapped line is transformed as three copies of itself, the middle of
+    /// which then sees the nearest site in either direction across the seam.
+    /// Samples at an infinite distance root no parabola, so every meeting is
+    /// found between finite values, and a line with none remains infinite.
+
+    struct line
+    {
+        line(int n, bool wrapped)
+            : n(n), m(wrapped ? 3 * n : n), f(m), v(m), z(m + 1) { }
+
+        /// Replace the squared distances *p* to sites along the perpendicular
+        /// with the squared distances to the nearest site in the plane.
+
+        void transform(double *p)
+        {
+            const int o = (m - n) / 2;
+
+            for (int q = 0; q < m; ++q)
+                f[q] = p[q % n];
+
+            // Find the lower envelope of the parabolas rooted at each sample.
+
+            const double inf = std::numeric_limits<double>::infinity();
+
+            int k = -1;
+
+            for (int q = 0; q < m; ++q)
+                if (f[q] < inf)
+                {
+                    if (k < 0)
+                    {
+                        k    =  0;
+                        v[0] =  q;
+                        z[0] = -inf;
+                        z[1] =  inf;
+                    }
+                    else
+                    {
+                        double s = meet(q, v[k]);
+
+                        while (s <= z[k])
+                            s = meet(q, v[--k]);
+
+                        k++;
+                        v[k]     = q;
+                        z[k]     = s;
+                        z[k + 1] = inf;
+                    }
+                }
+
+            if (k < 0)
+                return;
+
+            // Sample the envelope.
+
+            k = 0;
+
+            for (int q = 0; q < m; ++q)
+            {
+                while (z[k + 1] < q)
+                    k++;
+
+                if (o <= q && q < o + n)
+                    p[q - o] = double(q - v[k]) * (q - v[k]) + f[v[k]];
+            }
+        }
+
+        /// Return the position at which the parabolas rooted at *q* and *r*
+        /// intersect.
+
+        double meet(int q, int r) const
+        {
+            return ((f[q] + double(q) * q) - (f[r] + double(r) * r))
+                 / (2.0 * (q - r));
+        }
+
+        int n;
+        int m;
+        std::vector<double> f;
+        std::vector<int>    v;
+        std::vector<double> z;
+    };
+};
+
+const float distance::far = std::numeric_limits<float>::infinity();
+
+//------------------------------------------------------------------------------
+
+#endif
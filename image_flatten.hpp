@@ -27,7 +27,7 @@ public:
 
     flatten(double value, image *L) : image(L), value(value) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const int h = L->get_height() / 2;
 
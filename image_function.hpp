@@ -24,7 +24,7 @@ public:
 
     absolute(image *L) : image(L) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return fabs(L->get(i, j, k));
     }
@@ -24,7 +24,7 @@ public:
 
     gain(double value, image *L) : image(L), value(value) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return L->get(i, j, k) * value;
     }
@@ -24,26 +24,30 @@ public:
     /// Read a raw-formatted data file named *name*. *Start* gives the offset
     /// into the file where the pixel data begins. *Height*, *width*, and
     /// *depth* give the size and channel count of this input. *Type* is a
-    /// character giving the @ref type "sample type".
+    /// character giving the @ref type "sample type". *Layout* is a character
+    /// giving the @ref layout "sample layout".
 
-    input(std::string name, int start, int height, int width, int depth, char type)
+    input(std::string name, int start, int height, int width, int depth, char type, char layout='p')
     {
         switch (type)
         {
-            case 'b': file = new rawb(name, start, height, width, depth, false); break;
-            case 'c': file = new rawc(name, start, height, width, depth, false); break;
-            case 'u': file = new rawu(name, start, height, width, depth, false); break;
-            case 'U': file = new rawU(name, start, height, width, depth, false); break;
-            case 's': file = new raws(name, start, height, width, depth, false); break;
-            case 'S': file = new rawS(name, start, height, width, depth, false); break;
-            case 'l': file = new rawl(name, start, height, width, depth, false); break;
-            case 'L': file = new rawL(name, start, height, width, depth, false); break;
-            case 'i': file = new rawi(name, start, height, width, depth, false); break;
-            case 'I': file = new rawI(name, start, height, width, depth, false); break;
-            case 'f': file = new rawf(name, start, height, width, depth, false); break;
-            case 'F': file = new rawF(name, start, height, width, depth, false); break;
-            case 'd': file = new rawd(name, start, height, width, depth, false); break;
-            case 'D': file = new rawD(name, start, height, width, depth, false); break;
+            case 'b': file = new rawb(name, start, height, width, depth, false, layout); break;
+            case 'c': file = new rawc(name, start, height, width, depth, false, layout); break;
+            case 'u': file = new rawu(name, start, height, width, depth, false, layout); break;
+            case 'U': file = new rawU(name, start, height, width, depth, false, layout); break;
+            case 's': file = new raws(name, start, height, width, depth, false, layout); break;
+            case 'S': file = new rawS(name, start, height, width, depth, false, layout); break;
+            case 'l': file = new rawl(name, start, height, width, depth, false, layout); break;
+            case 'L': file = new rawL(name, start, height, width, depth, false, layout); break;
+            case 'i': file = new rawi(name, start, height, width, depth, false, layout); break;
+            case 'I': file = new rawI(name, start, height, width, depth, false, layout); break;
+            case 'f': file = new rawf(name, start, height, width, depth, false, layout); break;
+            case 'F': file = new rawF(name, start, height, width, depth, false, layout); break;
+            case 'h': file = new rawh(name, start, height, width, depth, false, layout); break;
+            case 'H': file = new rawH(name, start, height, width, depth, false, layout); break;
+            case 'm': file = new rawm(name, start, height, width, depth, false, layout); break;
+            case 'd': file = new rawd(name, start, height, width, depth, false, layout); break;
+            case 'D': file = new rawD(name, start, height, width, depth, false, layout); break;
         }
     }
 
@@ -52,13 +56,62 @@ public:
         delete file;
     }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return (0 <= i && i < file->get_height() &&
                 0 <= j && j < file->get_width () &&
                 0 <= k && k < file->get_depth ()) ? file->get(i, j, k) : 0.0;
     }
 
+    /// Decode a whole pixel at once rather than a sample at a time.
+
+    virtual void pixel(int i, int j, real *v) const
+    {
+        if (0 <= i && i < file->get_height() &&
+            0 <= j && j < file->get_width ())
+            file->get_row(i, j, j + 1, v);
+        else
+            image::pixel(i, j, v);
+    }
+
+    /// Decode a run of pixels lying within the file as a row. Runs that reach
+    /// outside of it, and those of a cached or profiled input, are sampled a
+    /// pixel at a time.
+
+    virtual void get_span(int i, int j0, int j1, real *v) const
+    {
+        if (!M && !C && 0 <= i  && i  < file->get_height()
+                     && 0 <= j0 && j1 <= file->get_width ())
+            file->get_row(i, j0, j1, v);
+        else
+            image::get_span(i, j0, j1, v);
+    }
+
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        i0 = std::max(i0, 0);
+        j0 = std::max(j0, 0);
+        i1 = std::min(i1, file->get_height());
+        j1 = std::min(j1, file->get_width ());
+
+        file->advise(i0, j0, i1, j1);
+    }
+
+    virtual bool copies(const std::type_info& t) const
+    {
+        return typeid(*file) == t;
+    }
+
+    virtual const raw *locate(int& i, int& j, int& k, int& n) const
+    {
+        if      (j < 0)                 n = std::min(n, -j);
+        else if (j < file->get_width()) n = std::min(n, file->get_width() - j);
+
+        return (0 <= i && i < file->get_height() &&
+                0 <= j && j < file->get_width () &&
+                0 <= k && k < file->get_depth ()) ? file : 0;
+    }
+
     virtual int get_height() const { return file->get_height(); }
     virtual int get_width () const { return file->get_width (); }
     virtual int get_depth () const { return file->get_depth (); }
@@ -24,27 +24,64 @@ public:
     /// given in the form of a matrix of size *rows* by *columns*. The input
     /// must have a depth equal to *columns* and the output will have a depth
     /// equal to *rows*. The vector *values* gives the matrix in row-major
-    /// order.
+    /// order. Up to 36 channels are supported on either side, as with
+    /// ::swizzle, so this serves for band ratios and linear unmixing of
+    /// multispectral images as well as color space transformations.
 
     matrix(int rows, int columns, std::vector<double> values, image *L)
-        : image(L), rows(rows), columns(columns), values(values)
+        : image(L), rows(rows), columns(columns)
     {
         if (columns != L->get_depth())
             throw std::runtime_error("Mismatched color matrix size");
+        if (rows < 1 || rows > 36 || columns < 1 || columns > 36)
+            throw std::runtime_error("Color matrix size out of range");
+        if (int(values.size()) != rows * columns)
+            throw std::runtime_error("Wrong number of color matrix values");
+
+        set(values, std::vector<double>(rows, 0.0));
     }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const int d = L->get_depth();
         double    v = 0;
 
         if (0 <= k && k < rows)
+        {
+            v = bias[k];
+
             for (int l = 0; l < d; l++)
                 if (double w = values[k * columns + l])
                     v += w * L->get(i, j, l);
+        }
         return v;
     }
 
+    /// Transform a whole pixel. Each input sample is scaled by a column of the
+    /// matrix and accumulated across all outputs at once, which vectorizes
+    /// without reordering any sum.
+
+    virtual void pixel(int i, int j, real *v) const
+    {
+        real   u[36];
+        double t[36];
+
+        L->get_pixel(i, j, u);
+
+        std::copy(bias.begin(), bias.end(), t);
+
+        for (int l = 0; l < columns; l++)
+        {
+            const double *w = &transpose[l * rows];
+            const double  s = u[l];
+
+            for (int k = 0; k < rows; k++)
+                t[k] += w[k] * s;
+        }
+
+        std::copy(t, t + rows, v);
+    }
+
     virtual int get_depth() const
     {
         return rows;
@@ -55,10 +92,29 @@ public:
         out << "matrix " << rows << " " << columns;
     }
 
+protected:
+
+    /// Replace the matrix with *values*, in row-major order, and add *bias*
+    /// to each output channel.
+
+    void set(const std::vector<double>& values, const std::vector<double>& bias)
+    {
+        this->values = values;
+        this->bias   = bias;
+
+        transpose.resize(values.size());
+
+        for     (int k = 0; k < rows;    k++)
+            for (int l = 0; l < columns; l++)
+                transpose[l * rows + k] = values[k * columns + l];
+    }
+
 private:
     int rows;
     int columns;
     std::vector<double> values;
+    std::vector<double> transpose;
+    std::vector<double> bias;
 };
 
 //------------------------------------------------------------------------------
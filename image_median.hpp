@@ -28,25 +28,31 @@ public:
     median(int radius, int mode, image *L)
         : image(L), radius(radius), mode(mode) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const int h = L->get_height();
         const int w = L->get_width ();
 
-        std::vector<double> v((2 * radius + 1) * (2 * radius + 1));
+        std::vector<real> v((2 * radius + 1) * (2 * radius + 1));
 
-        int z = 0;
-
-        for     (int y = -radius; y <= radius; y++)
-            for (int x = -radius; x <= radius; x++)
-                if (x * x + y * y <= radius * radius)
-                    v[z++] = L->get(wrap(i + y, h, mode & 1),
-                                    wrap(j + x, w, mode & 2), k);
+        const int z = inside(i, j, radius, radius, h, w)
+                    ? gather<false>(i, j, k, h, w, v)
+                    : gather<true >(i, j, k, h, w, v);
 
         std::nth_element(v.begin(), v.begin() + z / 2, v.begin() + z);
         return v[z / 2];
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 - radius, j0 - radius, i1 + radius, j1 + radius);
+    }
+
+    virtual int footprint() const
+    {
+        return L->footprint() + radius;
+    }
+
     virtual void tweak(int a, int v)
     {
         if (a == 0)
@@ -63,6 +69,25 @@ public:
 protected:
     int radius;
     int mode;
+
+private:
+
+    /// Gather the pixels of *L*, of height *h* and width *w*, within the disk
+    /// about pixel *i*, *j* into *v*, wrapping coordinates only if *B*. Return
+    /// the number gathered.
+
+    template <bool B> int gather(int i, int j, int k, int h, int w,
+                                 std::vector<real>& v) const
+    {
+        int z = 0;
+
+        for     (int y = -radius; y <= radius; y++)
+            for (int x = -radius; x <= radius; x++)
+                if (x * x + y * y <= radius * radius)
+                    v[z++] = L->get(wrap<B>(i + y, h, mode & 1),
+                                    wrap<B>(j + x, w, mode & 2), k);
+        return z;
+    }
 };
 
 //------------------------------------------------------------------------------
@@ -77,16 +102,20 @@ public:
 
     medianv(int radius, int mode, image *L) : median(radius, mode, L) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const int h = L->get_height();
 
-        std::vector<double> v(2 * radius + 1);
+        std::vector<real> v(2 * radius + 1);
 
         int z = 0;
 
-        for (int y = -radius; y <= radius; y++, z++)
-            v[z] = L->get(wrap(i + y, h, mode & 1), j, k);
+        if (radius <= i && i < h - radius)
+            for (int y = -radius; y <= radius; y++, z++)
+                v[z] = L->get(i + y, j, k);
+        else
+            for (int y = -radius; y <= radius; y++, z++)
+                v[z] = L->get(wrap(i + y, h, mode & 1), j, k);
 
         std::nth_element(v.begin(), v.begin() + z / 2, v.begin() + z);
         return v[z / 2];
@@ -111,16 +140,20 @@ public:
 
     medianh(int radius, int mode, image *L) : median(radius, mode, L) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const int w = L->get_width();
 
-        std::vector<double> v(2 * radius + 1);
+        std::vector<real> v(2 * radius + 1);
 
         int z = 0;
 
-        for (int x = -radius; x <= radius; x++, z++)
-            v[z] = L->get(i, wrap(j + x, w, mode & 2), k);
+        if (radius <= j && j < w - radius)
+            for (int x = -radius; x <= radius; x++, z++)
+                v[z] = L->get(i, j + x, k);
+        else
+            for (int x = -radius; x <= radius; x++, z++)
+                v[z] = L->get(i, wrap(j + x, w, mode & 2), k);
 
         std::nth_element(v.begin(), v.begin() + z / 2, v.begin() + z);
         return v[z / 2];
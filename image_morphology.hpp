@@ -28,20 +28,25 @@ public:
     dilate(int radius, int mode, image *L)
         : image(L), radius(radius), mode(mode) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const int h = L->get_height();
         const int w = L->get_width ();
 
-        double v = std::numeric_limits<double>::min();
+        if (inside(i, j, radius, radius, h, w))
+            return extremum<false>(i, j, k, h, w);
+        else
+            return extremum<true >(i, j, k, h, w);
+    }
 
-        for     (int y = -radius; y <= +radius; y++)
-            for (int x = -radius; x <= +radius; x++)
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 - radius, j0 - radius, i1 + radius, j1 + radius);
+    }
 
-                if (x * x + y * y <= radius * radius)
-                    v = std::max(v, L->get(wrap(i + y, h, mode & 1),
-                                           wrap(j + x, w, mode & 2), k));
-        return v;
+    virtual int footprint() const
+    {
+        return L->footprint() + radius;
     }
 
     virtual void doc(std::ostream& out) const
@@ -52,6 +57,24 @@ public:
 protected:
     int radius;
     int mode;
+
+private:
+
+    /// Find the maximum of *L*, of height *h* and width *w*, within the
+    /// disk about pixel *i*, *j*, wrapping coordinates only if *B*.
+
+    template <bool B> double extremum(int i, int j, int k, int h, int w) const
+    {
+        real v = std::numeric_limits<real>::min();
+
+        for     (int y = -radius; y <= +radius; y++)
+            for (int x = -radius; x <= +radius; x++)
+
+                if (x * x + y * y <= radius * radius)
+                    v = std::max(v, L->get(wrap<B>(i + y, h, mode & 1),
+                                           wrap<B>(j + x, w, mode & 2), k));
+        return v;
+    }
 };
 
 //------------------------------------------------------------------------------
@@ -69,20 +92,25 @@ public:
     erode(int radius, int mode, image *L)
         : image(L), radius(radius), mode(mode) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const int h = L->get_height();
         const int w = L->get_width ();
 
-        double v = std::numeric_limits<double>::max();
+        if (inside(i, j, radius, radius, h, w))
+            return extremum<false>(i, j, k, h, w);
+        else
+            return extremum<true >(i, j, k, h, w);
+    }
 
-        for     (int y = -radius; y <= +radius; y++)
-            for (int x = -radius; x <= +radius; x++)
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 - radius, j0 - radius, i1 + radius, j1 + radius);
+    }
 
-                if (x * x + y * y <= radius * radius)
-                    v = std::min(v, L->get(wrap(i + y, h, mode & 1),
-                                           wrap(j + x, w, mode & 2), k));
-        return v;
+    virtual int footprint() const
+    {
+        return L->footprint() + radius;
     }
 
     virtual void doc(std::ostream& out) const
@@ -93,6 +121,24 @@ public:
 protected:
     int radius;
     int mode;
+
+private:
+
+    /// Find the minimum of *L*, of height *h* and width *w*, within the
+    /// disk about pixel *i*, *j*, wrapping coordinates only if *B*.
+
+    template <bool B> double extremum(int i, int j, int k, int h, int w) const
+    {
+        real v = std::numeric_limits<real>::max();
+
+        for     (int y = -radius; y <= +radius; y++)
+            for (int x = -radius; x <= +radius; x++)
+
+                if (x * x + y * y <= radius * radius)
+                    v = std::min(v, L->get(wrap<B>(i + y, h, mode & 1),
+                                           wrap<B>(j + x, w, mode & 2), k));
+        return v;
+    }
 };
 
 //------------------------------------------------------------------------------
@@ -26,12 +26,37 @@ public:
     offset(int rows, int columns, int mode, image *L)
         : image(L), rows(rows), columns(columns), mode(mode) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return L->get(wrap(i - rows,    L->get_height(), mode & 1),
                       wrap(j - columns, L->get_width (), mode & 2), k);
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 - rows, j0 - columns, i1 - rows, j1 - columns);
+    }
+
+    virtual bool copies(const std::type_info& t) const
+    {
+        return L->copies(t);
+    }
+
+    virtual const raw *locate(int& i, int& j, int& k, int& n) const
+    {
+        const int w = L->get_width();
+        const int u = j - columns;
+
+        i = wrap(i - rows,    L->get_height(), mode & 1);
+        j = wrap(u,           w,               mode & 2);
+
+        // A span ends at the seam, and a clamped sample stands alone.
+
+        n = (j == u || (mode & 2)) ? std::min(n, w - j) : 1;
+
+        return L->locate(i, j, k, n);
+    }
+
     virtual void tweak(int a, int v)
     {
         if (a == 0) columns += v;
@@ -21,12 +21,17 @@ class output : public image
 {
 public:
     /// Write a raw-formatted data file named *name*. *Type* is a character
-    /// giving the output @ref type "sample type". The image height, width, and
+    /// giving the output @ref type "sample type" and *layout* a character
+    /// giving its @ref layout "sample layout". The image height, width, and
     /// depth are given by the *L* image object. Unsigned samples are clamped to
     /// the range [0,1] and signed samples to the range [-1,+1] before being
-    /// cast to the destination data type.
+    /// cast to the destination data type. If *L* #copies files of the same
+    /// sample type, such as an ::input or a ::crop, ::paste, ::offset,
+    /// ::swizzle, or ::append of them, its samples are copied as bytes
+    /// without conversion. This makes conversion between layouts and the
+    /// assembly of tiled products lossless.
 
-    output(std::string name, char type, image *L)
+    output(std::string name, char type, char layout, image *L)
         : image(L), cache(false), file(0), chars(0)
     {
         const int height = L->get_height();
@@ -35,20 +40,23 @@ public:
 
         switch (type)
         {
-            case 'b': file = new rawb(name, 0, height, width, depth, true); break;
-            case 'c': file = new rawc(name, 0, height, width, depth, true); break;
-            case 'u': file = new rawu(name, 0, height, width, depth, true); break;
-            case 'U': file = new rawU(name, 0, height, width, depth, true); break;
-            case 's': file = new raws(name, 0, height, width, depth, true); break;
-            case 'S': file = new rawS(name, 0, height, width, depth, true); break;
-            case 'l': file = new rawl(name, 0, height, width, depth, true); break;
-            case 'L': file = new rawL(name, 0, height, width, depth, true); break;
-            case 'i': file = new rawi(name, 0, height, width, depth, true); break;
-            case 'I': file = new rawI(name, 0, height, width, depth, true); break;
-            case 'f': file = new rawf(name, 0, height, width, depth, true); break;
-            case 'F': file = new rawF(name, 0, height, width, depth, true); break;
-            case 'd': file = new rawd(name, 0, height, width, depth, true); break;
-            case 'D': file = new rawD(name, 0, height, width, depth, true); break;
+            case 'b': file = new rawb(name, 0, height, width, depth, true, layout); break;
+            case 'c': file = new rawc(name, 0, height, width, depth, true, layout); break;
+            case 'u': file = new rawu(name, 0, height, width, depth, true, layout); break;
+            case 'U': file = new rawU(name, 0, height, width, depth, true, layout); break;
+            case 's': file = new raws(name, 0, height, width, depth, true, layout); break;
+            case 'S': file = new rawS(name, 0, height, width, depth, true, layout); break;
+            case 'l': file = new rawl(name, 0, height, width, depth, true, layout); break;
+            case 'L': file = new rawL(name, 0, height, width, depth, true, layout); break;
+            case 'i': file = new rawi(name, 0, height, width, depth, true, layout); break;
+            case 'I': file = new rawI(name, 0, height, width, depth, true, layout); break;
+            case 'f': file = new rawf(name, 0, height, width, depth, true, layout); break;
+            case 'F': file = new rawF(name, 0, height, width, depth, true, layout); break;
+            case 'h': file = new rawh(name, 0, height, width, depth, true, layout); break;
+            case 'H': file = new rawH(name, 0, height, width, depth, true, layout); break;
+            case 'm': file = new rawm(name, 0, height, width, depth, true, layout); break;
+            case 'd': file = new rawd(name, 0, height, width, depth, true, layout); break;
+            case 'D': file = new rawD(name, 0, height, width, depth, true, layout); break;
         }
     }
 
@@ -57,7 +65,7 @@ public:
         delete file;
     }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         if (0 <= i && i < file->get_height() &&
             0 <= j && j < file->get_width () &&
@@ -71,6 +79,45 @@ public:
         return 0.0;
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        if (cache)
+        {
+            i0 = std::max(i0, 0);
+            j0 = std::max(j0, 0);
+            i1 = std::min(i1, file->get_height());
+            j1 = std::min(j1, file->get_width ());
+
+            file->advise(i0, j0, i1, j1);
+        }
+        else L->advise(i0, j0, i1, j1);
+    }
+
+    virtual int footprint() const
+    {
+        return cache ? 0 : L->footprint();
+    }
+
+    virtual bool copies(const std::type_info& t) const
+    {
+        return cache ? typeid(*file) == t : L->copies(t);
+    }
+
+    virtual const raw *locate(int& i, int& j, int& k, int& n) const
+    {
+        if (cache)
+        {
+            if      (j < 0)                 n = std::min(n, -j);
+            else if (j < file->get_width()) n = std::min(n, file->get_width() - j);
+
+            return (0 <= i && i < file->get_height() &&
+                    0 <= j && j < file->get_width () &&
+                    0 <= k && k < file->get_depth ()) ? file : 0;
+        }
+        else
+            return L->locate(i, j, k, n);
+    }
+
     virtual void doc(std::ostream& out) const
     {
         out << "output " << file->get_name  ()
@@ -84,38 +131,103 @@ public:
     /// instead of invoking the process. This is useful as an optimization,
     /// especially for processes that feed large-kernel convolutions, as it
     /// eliminates the need to repeatedly compute expensive samples.
+    ///
+    /// The image is divided into square tiles large enough that the kernel
+    /// footprint of the process adds little to the working set of each. If
+    /// the footprint is small, the tiles are instead whole rows, which read
+    /// and write each source and destination row in one piece. Tiles are
+    /// dealt out to threads in contiguous runs of Morton order, and a
+    /// thread that finishes its run steals the back half of the longest one
+    /// remaining.
+    ///
+    /// The image is processed top to bottom in bands of whole tile rows. The
+    /// sources of each band, widened by the kernel footprint of each image
+    /// along the way, are advised while the band before it is processed.
+    ///
+    /// If a dirty memory #ceiling is set, the bands are a quarter of that
+    /// size. Each band is written back as soon as it is complete, and its
+    /// pages are released once the next band is complete too. With a pread /
+    /// pwrite raw::backend, the bands are staged in memory and written by a
+    /// background thread.
 
     virtual void process()
     {
-        int f, g = 8, c = 0;
-        int i, h = get_height();
-        int j, w = get_width ();
-        int k, d = get_depth ();
+        const int h = get_height();
+        const int w = get_width ();
+        int c = 0;
 
         image::process();
+        prepare();
+
+        // Choose a tile size and a band height of whole tile rows. Without a
+        // ceiling, give each band at least four rows of square tiles and four
+        // tiles per thread. Below the minimum footprint of a square tile, use
+        // full-width tiles of a few rows each.
 
-        // Divide the set of all scanlines into groups of size g.
+        const int  r = L->footprint();
+        const int  q = tile_size(r);
+        const bool f = (4 * r < tile_size(0));
 
-        #pragma omp parallel for private(i, j, k) schedule(dynamic)
-        for (f = 0; f < h; f += g)
+        int s = f ? w : q;
+        int t = f ? std::max(1, 16384 / std::max(w, 1)) : q;
+        int b = q * std::max(4, (4 * omp_get_max_threads() * q + w - 1) / w);
+
+        b = (b + t - 1) / t * t;
+
+        // Under a ceiling, give each band a quarter of it in whole rows of
+        // tiles, or in whole rows of file tiles if the file is tiled, but no
+        // less than one such row.
+
+        const int g = file->get_grain();
+
+        if (ceiling)
         {
-            // Process each group in parallel.
+            const size_t m = std::max(ceiling / 4 / file->get_pitch(),
+                                      size_t(1));
+
+            t = int(std::min(size_t(t), m));
+
+            const int u = (g > 1) ? g : t;
 
-            int l = std::min(f + g, h);
+            b = int(std::min(size_t(h), m / u * u));
+            b = std::max(b, u);
+            t = std::min(t, b);
+        }
+
+        // Align bands with the rows of tiles of a tiled file.
+
+        b = (b + g - 1) / g * g;
+
+        // Process each band, keeping at most two in flight. Advise the
+        // sources of each band while the one before it is processed.
 
-            for         (i = f; i < l; ++i)
-                for     (j = 0; j < w; ++j)
-                    for (k = 0; k < d; ++k)
-                        file->put(i, j, k, L->get(i, j, k));
+        const bool flush = ceiling || file->staged();
+        int released = 0;
+
+        L->advise(0, 0, std::min(b, h), w);
+
+        for (int i = 0; i < h; i += b)
+        {
+            const int e = std::min(i + b, h);
 
-            // Report a running total of completed scan lines.
+            L->advise(e, 0, std::min(e + b, h), w);
+            file->stage(i, e);
 
-            #pragma omp critical
-            c += g;
+            band(i, e, t, s, c);
 
-            if (omp_get_thread_num() == 0)
-                report(c, h);
+            if (flush)
+            {
+                file->writeback(i, e);
+
+                if (i - b > released)
+                {
+                    file->release(released, i - b);
+                    released = i - b;
+                }
+            }
         }
+        if (flush)
+            file->release(released, h);
 
         // Finish the report and enable the cache.
 
@@ -123,11 +235,220 @@ public:
         cache = true;
     }
 
+    /// Bound the memory used by pages written but not yet flushed to the
+    /// file during #process. Zero gives no bound.
+
+    static size_t ceiling;
+
 private:
     bool cache;
     raw *file;
     int  chars;
 
+    /// Process rows *i0* through *i1* - 1 in tiles of height *t* and width
+    /// *s*, adding the number of samples written to *c*.
+
+    void band(int i0, int i1, int t, int s, int& c)
+    {
+        const int w = get_width ();
+        const int h = get_height();
+        const int d = get_depth ();
+
+        const bool copy = L->copies(typeid(*file));
+
+        // A new file reads as zeros, so blocks of zeros need not be written
+        // through the mapping, which would fault in and dirty their pages
+        // only for them to be punched out again.
+
+        const bool sparse = !file->staged();
+
+        // Enumerate the tiles in Morton order.
+
+        std::vector<int> order = morton((i1 - i0 + t - 1) / t, (w + s - 1) / s);
+
+        // Give each thread an equal run of tiles.
+
+        const int n = omp_get_max_threads();
+        std::vector<run> runs(n);
+
+        for (int u = 0; u < n; ++u)
+        {
+            runs[u].head = int(order.size() * long(u    ) / n);
+            runs[u].tail = int(order.size() * long(u + 1) / n);
+            omp_init_lock(&runs[u].lock);
+        }
+
+        #pragma omp parallel num_threads(n)
+        {
+            const int me = omp_get_thread_num();
+            int u;
+
+            std::vector<real> row(size_t(s) * d);
+
+            while ((u = next(runs, me)) >= 0)
+            {
+                // Process each tile in row-major order.
+
+                const int ia = (order[u] >> 16) * t + i0, ib = std::min(ia + t, i1);
+                const int ja = (order[u] & 0xFFFF) * s,   jb = std::min(ja + s, w);
+
+                if (copy)
+                    for         (int i = ia; i < ib; ++i)
+                        for     (int k = 0;  k <  d; ++k)
+                            for (int j = ja, n;  j < jb; j += n)
+                            {
+                                int a = i, b = j, c = k;
+
+                                n = jb - j;
+
+                                if (const raw *f = L->locate(a, b, c, n))
+                                    file->copy(i, j, k, *f, a, b, c, n);
+                                else if (!sparse)
+                                    for (int e = j; e < j + n; ++e)
+                                        file->put(i, e, k, 0.0);
+                            }
+                else
+                    for (int i = ia; i < ib; ++i)
+                    {
+                        L->get_span(i, ja, jb, &row.front());
+
+                        if (!sparse || !zeros(&row.front(), size_t(jb - ja) * d))
+                            file->put_row(i, ja, jb, &row.front());
+                    }
+
+                // Report a running total of completed scan lines.
+
+                #pragma omp atomic
+                c += (ib - ia) * (jb - ja);
+
+                if (me == 0)
+                    report(int(double(c) / w), h);
+            }
+        }
+
+        for (int u = 0; u < n; ++u)
+            omp_destroy_lock(&runs[u].lock);
+    }
+
+    /// A run of tiles remaining to be processed by one thread.
+
+    struct run
+    {
+        int        head;
+        int        tail;
+        omp_lock_t lock;
+    };
+
+    /// Return the index of the next tile to be processed by thread *me*,
+    /// stealing from the longest run of another thread if necessary. Return
+    /// -1 if no tiles remain.
+
+    static int next(std::vector<run>& runs, int me)
+    {
+        int t = -1;
+
+        omp_set_lock(&runs[me].lock);
+        if (runs[me].head < runs[me].tail)
+            t = runs[me].head++;
+        omp_unset_lock(&runs[me].lock);
+
+        while (t < 0)
+        {
+            // Find the longest remaining run.
+
+            int v = -1, m = 0;
+
+            for (int u = 0; u < int(runs.size()); ++u)
+            {
+                omp_set_lock(&runs[u].lock);
+                if (runs[u].tail - runs[u].head > m)
+                {
+                    m = runs[u].tail - runs[u].head;
+                    v = u;
+                }
+                omp_unset_lock(&runs[u].lock);
+            }
+            if (v < 0)
+                return -1;
+
+            // Take the back half of it, if it still has any.
+
+            int a = 0, b = 0;
+
+            omp_set_lock(&runs[v].lock);
+            if (runs[v].head < runs[v].tail)
+            {
+                a = runs[v].head + (runs[v].tail - runs[v].head) / 2;
+                b = runs[v].tail;
+                runs[v].tail = a;
+            }
+            omp_unset_lock(&runs[v].lock);
+
+            if (a < b)
+            {
+                omp_set_lock(&runs[me].lock);
+                runs[me].head = a + 1;
+                runs[me].tail = b;
+                omp_unset_lock(&runs[me].lock);
+                t = a;
+            }
+        }
+        return t;
+    }
+
+    /// Return a tile size for a process with kernel footprint *r*. A tile of
+    /// four times the footprint at most doubles the area of source sampled.
+
+    static int tile_size(int r)
+    {
+        int s = 64;
+
+        while (s < 4 * r && s < 1024)
+            s *= 2;
+
+        return s;
+    }
+
+    /// Are all *n* samples at *p* positive zeros, which encode as zero bytes
+    /// in every sample type?
+
+    static bool zeros(const real *p, size_t n)
+    {
+        const uint8_t *q = (const uint8_t *) p;
+        const size_t   m = n * sizeof (real);
+
+        return m == 0 || (q[0] == 0 && memcmp(q, q + 1, m - 1) == 0);
+    }
+
+    /// Return the tiles of an *m* by *n* grid in Morton order, each encoded
+    /// with row in the upper and column in the lower 16 bits.
+
+    static std::vector<int> morton(int m, int n)
+    {
+        std::vector<std::pair<long, int> > v;
+
+        for     (int i = 0; i < m; ++i)
+            for (int j = 0; j < n; ++j)
+            {
+                long z = 0;
+
+                for (int b = 0; b < 16; ++b)
+                    z |= long((i >> b) & 1) << (2 * b + 1)
+                      |  long((j >> b) & 1) << (2 * b);
+
+                v.push_back(std::make_pair(z, (i << 16) | j));
+            }
+
+        std::sort(v.begin(), v.end());
+
+        std::vector<int> order;
+
+        for (size_t t = 0; t < v.size(); ++t)
+            order.push_back(v[t].second);
+
+        return order;
+    }
+
     void report(int i, int n)
     {
         std::ostringstream stream;
@@ -145,6 +466,8 @@ private:
     }
 };
 
+size_t output::ceiling = size_t(256) << 20;
+
 //------------------------------------------------------------------------------
 
 #endif
@@ -29,7 +29,7 @@ public:
     paste(int row, int column, image *L, image *R)
         : image(L, R), row(row), column(column) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         if (row    <= i && i < row    + L->get_height() &&
             column <= j && j < column + L->get_width())
@@ -39,6 +39,40 @@ public:
             return R->get(i, j, k);
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        const int a0 = std::max(i0 - row,    0);
+        const int b0 = std::max(j0 - column, 0);
+        const int a1 = std::min(i1 - row,    L->get_height());
+        const int b1 = std::min(j1 - column, L->get_width ());
+
+        if (a0 < a1 && b0 < b1)
+            L->advise(a0, b0, a1, b1);
+
+        R->advise(i0, j0, i1, j1);
+    }
+
+    virtual bool copies(const std::type_info& t) const
+    {
+        return L->copies(t) && R->copies(t);
+    }
+
+    virtual const raw *locate(int& i, int& j, int& k, int& n) const
+    {
+        const bool in = (row <= i && i < row + L->get_height());
+
+        if (in && column <= j && j < column + L->get_width())
+        {
+            n = std::min(n, column + L->get_width() - j);
+            return L->locate(i -= row, j -= column, k, n);
+        }
+        else
+        {
+            if (in && j < column) n = std::min(n, column - j);
+            return R->locate(i, j, k, n);
+        }
+    }
+
     virtual int get_height() const
     {
         return std::max(L->get_height() + row,    R->get_height());
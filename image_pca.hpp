@@ -0,0 +1,257 @@
+// RAWK Copyright (C) 2014 Robert Kooima
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef IMAGE_PCA_HPP
+#define IMAGE_PCA_HPP
+
+//------------------------------------------------------------------------------
+
+/// Principal component analysis filter
+
+class pca : public matrix
+{
+public:
+    /// Project the channels of image *L* onto their first *n* principal
+    /// components, in order of decreasing variance. Each component is centered
+    /// on the mean and signed so that its largest coefficient is positive.
+    ///
+    /// The mean and covariance of the channels are found by a pass over all of
+    /// *L*, made when this image is processed or prepared for preview and made
+    /// again after any image below this one is modified. Rows are accumulated
+    /// in parallel in blocks whose number does not depend on the thread count,
+    /// and the blocks are summed in order, so the result is reproducible.
+
+    pca(int n, image *L)
+        : matrix(n, L->get_depth(), std::vector<double>(n * L->get_depth()), L),
+          seen(-1)
+    {
+        if (n > L->get_depth())
+            throw std::runtime_error("More principal components than channels");
+    }
+
+    virtual void prepare()
+    {
+        image::prepare();
+
+        if (seen != L->get_changes())
+        {
+            analyze();
+            seen = L->get_changes();
+        }
+    }
+
+    virtual void process()
+    {
+        image::process();
+        prepare();
+    }
+
+    virtual void doc(std::ostream& out) const
+    {
+        out << "pca " << get_depth();
+    }
+
+private:
+    int seen;  ///< Modification count of L at the last analysis
+
+    /// Accumulate the mean and covariance of the channels of *L* and set the
+    /// matrix to the leading eigenvectors of the covariance.
+
+    void analyze()
+    {
+        const int h = L->get_height();
+        const int w = L->get_width ();
+        const int d = L->get_depth ();
+        const int m = d + d * d;
+
+        // Samples are taken relative to the first pixel, for stability.
+
+        std::vector<real> z(d);
+
+        if (h > 0 && w > 0)
+            L->get_pixel(0, 0, &z.front());
+
+        // Accumulate sums and products in blocks of rows, a band of blocks at
+        // a time, advising each band while the one before it is summed.
+
+        const int g = std::max(64, (h + 255) / 256);
+        const int n = (h + g - 1) / g;
+        const int q = 4 * omp_get_max_threads();
+
+        std::vector<double> part(size_t(n) * m, 0.0);
+
+        L->advise(0, 0, std::min(q * g, h), w);
+
+        for (int a = 0; a < n; a += q)
+        {
+            const int b = std::min(a + q, n);
+
+            L->advise(b * g, 0, std::min((b + q) * g, h), w);
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int u = a; u < b; ++u)
+            {
+                std::vector<real>   x(d);
+                std::vector<double> y(d);
+
+                double *s = &part[size_t(u) * m];
+                double *p = s + d;
+
+                for     (int i = u * g; i < std::min(u * g + g, h); ++i)
+                    for (int j = 0; j < w; ++j)
+                    {
+                        L->get_pixel(i, j, &x.front());
+
+                        for (int k = 0; k < d; ++k)
+                            s[k] += (y[k] = x[k] - z[k]);
+
+                        for     (int k = 0; k < d; ++k)
+                            for (int l = k; l < d; ++l)
+                                p[k * d + l] += y[k] * y[l];
+                    }
+            }
+        }
+
+        // Merge the blocks in order and find the mean and covariance.
+
+        std::vector<double> t(m, 0.0);
+
+        for     (int u = 0; u < n; ++u)
+            for (int k = 0; k < m; ++k)
+                t[k] += part[size_t(u) * m + k];
+
+        const double N = std::max(double(h) * double(w), 2.0);
+
+        std::vector<double> mean(d);
+        std::vector<double> C(d * d);
+
+        for (int k = 0; k < d; ++k)
+            mean[k] = z[k] + t[k] / N;
+
+        for     (int k = 0; k < d; ++k)
+            for (int l = k; l < d; ++l)
+                C[k * d + l] = C[l * d + k] = (t[d + k * d + l]
+                                             - t[k] * t[l] / N) / (N - 1);
+
+        // Project onto the leading eigenvectors.
+
+        std::vector<double> V;
+        std::vector<double> e;
+
+        eigen(C, d, V, e);
+
+        std::vector<int> o(d);
+
+        for (int k = 0; k < d; ++k)
+            o[k] = k;
+
+        std::stable_sort(o.begin(), o.end(), by_value(e));
+
+        const int r = get_depth();
+
+        std::vector<double> values(r * d);
+        std::vector<double> bias  (r);
+
+        for (int c = 0; c < r; ++c)
+        {
+            int f = 0;
+
+            for (int k = 1; k < d; ++k)
+                if (fabs(V[k * d + o[c]]) > fabs(V[f * d + o[c]]))
+                    f = k;
+
+            const double g = (V[f * d + o[c]] < 0) ? -1.0 : 1.0;
+
+            for (int k = 0; k < d; ++k)
+            {
+                values[c * d + k] = g * V[k * d + o[c]];
+                bias  [c]        -= g * V[k * d + o[c]] * mean[k];
+            }
+        }
+        set(values, bias);
+    }
+
+    /// Order indices by decreasing eigenvalue.
+
+    struct by_value
+    {
+        by_value(const std::vector<double>& e) : e(e) { }
+        bool operator()(int a, int b) const { return e[a] > e[b]; }
+        const std::vector<double>& e;
+    };
+
+    /// Find the eigenvalues *e* and eigenvectors, the columns of *V*, of the
+    /// symmetric *d* by *d* matrix *A* using cyclic Jacobi rotations.
+
+    static void eigen(std::vector<double> A, int d,
+                      std::vector<double>& V, std::vector<double>& e)
+    {
+        V.assign(d * d, 0.0);
+        e.assign(d,     0.0);
+
+        for (int k = 0; k < d; ++k)
+            V[k * d + k] = 1.0;
+
+        for (int sweep = 0; sweep < 100; ++sweep)
+        {
+            double off = 0;
+
+            for     (int p = 0;     p < d; ++p)
+                for (int q = p + 1; q < d; ++q)
+                    off += A[p * d + q] * A[p * d + q];
+
+            if (off < 1e-30)
+                break;
+
+            for     (int p = 0;     p < d; ++p)
+                for (int q = p + 1; q < d; ++q)
+                    if (A[p * d + q] != 0.0)
+                    {
+                        const double x = (A[q * d + q] - A[p * d + p])
+                                       / (2.0 * A[p * d + q]);
+                        const double t = ((x < 0) ? -1.0 : 1.0)
+                                       / (fabs(x) + sqrt(x * x + 1.0));
+                        const double c = 1.0 / sqrt(t * t + 1.0);
+                        const double s = t * c;
+
+                        for (int k = 0; k < d; ++k)
+                        {
+                            const double a = A[k * d + p];
+                            const double b = A[k * d + q];
+                            A[k * d + p] = c * a - s * b;
+                            A[k * d + q] = s * a + c * b;
+                        }
+                        for (int k = 0; k < d; ++k)
+                        {
+                            const double a = A[p * d + k];
+                            const double b = A[q * d + k];
+                            A[p * d + k] = c * a - s * b;
+                            A[q * d + k] = s * a + c * b;
+                        }
+                        for (int k = 0; k < d; ++k)
+                        {
+                            const double a = V[k * d + p];
+                            const double b = V[k * d + q];
+                            V[k * d + p] = c * a - s * b;
+                            V[k * d + q] = s * a + c * b;
+                        }
+                    }
+        }
+
+        for (int k = 0; k < d; ++k)
+            e[k] = A[k * d + k];
+    }
+};
+
+//------------------------------------------------------------------------------
+
+#endif
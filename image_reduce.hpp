@@ -27,7 +27,7 @@ public:
 
     reduce(image *L) : image(L) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return (L->get(i * 2 + 0, j * 2 + 0, k) +
                 L->get(i * 2 + 0, j * 2 + 1, k) +
@@ -35,6 +35,16 @@ public:
                 L->get(i * 2 + 1, j * 2 + 1, k)) / 4.0;
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 * 2, j0 * 2, i1 * 2, j1 * 2);
+    }
+
+    virtual int footprint() const
+    {
+        return (L->footprint() + 1) / 2 + 1;
+    }
+
     virtual int get_height() const { return L->get_height() / 2; }
     virtual int get_width () const { return L->get_width () / 2; }
 
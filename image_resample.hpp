@@ -44,6 +44,23 @@ public:
     virtual int get_height() const { return height; }
     virtual int get_width () const { return width;  }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        const double y = double(L->get_height()) / double(height);
+        const double x = double(L->get_width ()) / double(width);
+
+        L->advise(int(floor(i0 * y)) - 1, int(floor(j0 * x)) - 1,
+                  int( ceil(i1 * y)) + 2, int( ceil(j1 * x)) + 2);
+    }
+
+    virtual int footprint() const
+    {
+        const double y = double(height) / double(L->get_height());
+        const double x = double(width)  / double(L->get_width ());
+
+        return int(ceil((L->footprint() + 2) * std::max(y, x)));
+    }
+
     virtual void tweak(int a, int v)
     {
         if (a == 0) width  -= v;
@@ -68,7 +85,7 @@ public:
 
     nearest(int height, int width, image *L) : resample(height, width, 0, L) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         const long long hh = (long long) L->get_height();
         const long long ww = (long long) L->get_width();
@@ -96,7 +113,7 @@ public:
     linear(int height, int width, int mode, image *L)
         : resample(height, width, mode, L) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         int hh = L->get_height();
         int ww = L->get_width();
@@ -107,10 +124,18 @@ public:
         double s = ii - floor(ii);
         double t = jj - floor(jj);
 
-        int ia = wrap(int(floor(ii)), hh, mode & 1);
-        int ib = wrap(int( ceil(ii)), hh, mode & 1);
-        int ja = wrap(int(floor(jj)), ww, mode & 2);
-        int jb = wrap(int( ceil(jj)), ww, mode & 2);
+        int ia = int(floor(ii));
+        int ib = int( ceil(ii));
+        int ja = int(floor(jj));
+        int jb = int( ceil(jj));
+
+        if (!(0 <= ia && ib < hh && 0 <= ja && jb < ww))
+        {
+            ia = wrap(ia, hh, mode & 1);
+            ib = wrap(ib, hh, mode & 1);
+            ja = wrap(ja, ww, mode & 2);
+            jb = wrap(jb, ww, mode & 2);
+        }
 
         double aa = L->get(ia, ja, k);
         double ab = L->get(ia, jb, k);
@@ -140,7 +165,7 @@ public:
     cubic(int height, int width, int mode, image *L)
         : resample(height, width, mode, L) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         int hh = L->get_height();
         int ww = L->get_width();
@@ -151,15 +176,28 @@ public:
         double s = ii - floor(ii);
         double t = jj - floor(jj);
 
-        int ib = wrap(int(floor(ii)), hh, mode & 1);
-        int ic = wrap(int( ceil(ii)), hh, mode & 1);
-        int jb = wrap(int(floor(jj)), ww, mode & 2);
-        int jc = wrap(int( ceil(jj)), ww, mode & 2);
-
-        int ia = wrap(ib - 1, hh, mode & 1);
-        int id = wrap(ic + 1, hh, mode & 1);
-        int ja = wrap(jb - 1, ww, mode & 2);
-        int jd = wrap(jc + 1, ww, mode & 2);
+        int ib = int(floor(ii));
+        int ic = int( ceil(ii));
+        int jb = int(floor(jj));
+        int jc = int( ceil(jj));
+
+        int ia = ib - 1;
+        int id = ic + 1;
+        int ja = jb - 1;
+        int jd = jc + 1;
+
+        if (!(0 <= ia && id < hh && 0 <= ja && jd < ww))
+        {
+            ib = wrap(ib, hh, mode & 1);
+            ic = wrap(ic, hh, mode & 1);
+            jb = wrap(jb, ww, mode & 2);
+            jc = wrap(jc, ww, mode & 2);
+
+            ia = wrap(ib - 1, hh, mode & 1);
+            id = wrap(ic + 1, hh, mode & 1);
+            ja = wrap(jb - 1, ww, mode & 2);
+            jd = wrap(jc + 1, ww, mode & 2);
+        }
 
         double aa = L->get(ia, ja, k);
         double ab = L->get(ia, jb, k);
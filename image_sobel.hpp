@@ -25,12 +25,16 @@ public:
 
     sobelx(int mode, image *L) : image(L), mode(mode) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
-        const int in = wrap(i - 1, L->get_height(), mode & 1);
-        const int is = wrap(i + 1, L->get_height(), mode & 1);
-        const int jw = wrap(j - 1, L->get_width (), mode & 2);
-        const int je = wrap(j + 1, L->get_width (), mode & 2);
+        const int  h = L->get_height();
+        const int  w = L->get_width ();
+        const bool b = !inside(i, j, 1, 1, h, w);
+
+        const int in = b ? wrap(i - 1, h, mode & 1) : i - 1;
+        const int is = b ? wrap(i + 1, h, mode & 1) : i + 1;
+        const int jw = b ? wrap(j - 1, w, mode & 2) : j - 1;
+        const int je = b ? wrap(j + 1, w, mode & 2) : j + 1;
 
         double d1 = L->get(in, jw, k);
         double d3 = L->get(in, je, k);
@@ -42,6 +46,16 @@ public:
         return d3 - d1 + 2.0 * (d6 - d4) + d9 - d7;
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 - 1, j0 - 1, i1 + 1, j1 + 1);
+    }
+
+    virtual int footprint() const
+    {
+        return L->footprint() + 1;
+    }
+
     virtual void doc(std::ostream& out) const
     {
         out << "sobelx " << mode;
@@ -63,12 +77,16 @@ public:
 
     sobely(int mode, image *L) : image(L), mode(mode) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
-        const int in = wrap(i - 1, L->get_height(), mode & 1);
-        const int is = wrap(i + 1, L->get_height(), mode & 1);
-        const int jw = wrap(j - 1, L->get_width (), mode & 2);
-        const int je = wrap(j + 1, L->get_width (), mode & 2);
+        const int  h = L->get_height();
+        const int  w = L->get_width ();
+        const bool b = !inside(i, j, 1, 1, h, w);
+
+        const int in = b ? wrap(i - 1, h, mode & 1) : i - 1;
+        const int is = b ? wrap(i + 1, h, mode & 1) : i + 1;
+        const int jw = b ? wrap(j - 1, w, mode & 2) : j - 1;
+        const int je = b ? wrap(j + 1, w, mode & 2) : j + 1;
 
         double d1 = L->get(in, jw, k);
         double d2 = L->get(in, j,  k);
@@ -80,6 +98,16 @@ public:
         return d7 - d1 + 2.0 * (d8 - d2) + d9 - d3;
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 - 1, j0 - 1, i1 + 1, j1 + 1);
+    }
+
+    virtual int footprint() const
+    {
+        return L->footprint() + 1;
+    }
+
     virtual void doc(std::ostream& out) const
     {
         out << "sobely " << mode;
@@ -103,12 +131,16 @@ public:
     relief(double dy, double dx, int mode, image *L)
         : image(L), dy(dy), dx(dx), mode(mode) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
-        const int in = wrap(i - 1, L->get_height(), mode & 1);
-        const int is = wrap(i + 1, L->get_height(), mode & 1);
-        const int jw = wrap(j - 1, L->get_width (), mode & 2);
-        const int je = wrap(j + 1, L->get_width (), mode & 2);
+        const int  h = L->get_height();
+        const int  w = L->get_width ();
+        const bool b = !inside(i, j, 1, 1, h, w);
+
+        const int in = b ? wrap(i - 1, h, mode & 1) : i - 1;
+        const int is = b ? wrap(i + 1, h, mode & 1) : i + 1;
+        const int jw = b ? wrap(j - 1, w, mode & 2) : j - 1;
+        const int je = b ? wrap(j + 1, w, mode & 2) : j + 1;
 
         double d1 = L->get(in, jw, k);
         double d2 = L->get(in, j,  k);
@@ -131,6 +163,16 @@ public:
         if (a == 1) dy += v;
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 - 1, j0 - 1, i1 + 1, j1 + 1);
+    }
+
+    virtual int footprint() const
+    {
+        return L->footprint() + 1;
+    }
+
     virtual void doc(std::ostream& out) const
     {
         out << "relief " << dy << " " << dx << " " << mode;
@@ -155,12 +197,16 @@ public:
 
     gradient(int mode, image *L) : image(L), mode(mode) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
-        const int in = wrap(i - 1, L->get_height(), mode & 1);
-        const int is = wrap(i + 1, L->get_height(), mode & 1);
-        const int jw = wrap(j - 1, L->get_width (), mode & 2);
-        const int je = wrap(j + 1, L->get_width (), mode & 2);
+        const int  h = L->get_height();
+        const int  w = L->get_width ();
+        const bool b = !inside(i, j, 1, 1, h, w);
+
+        const int in = b ? wrap(i - 1, h, mode & 1) : i - 1;
+        const int is = b ? wrap(i + 1, h, mode & 1) : i + 1;
+        const int jw = b ? wrap(j - 1, w, mode & 2) : j - 1;
+        const int je = b ? wrap(j + 1, w, mode & 2) : j + 1;
 
         double d1 = L->get(in, jw, k);
         double d2 = L->get(in, j,  k);
@@ -177,6 +223,16 @@ public:
         return sqrt(Lx * Lx + Ly * Ly);
     }
 
+    virtual void advise(int i0, int j0, int i1, int j1) const
+    {
+        L->advise(i0 - 1, j0 - 1, i1 + 1, j1 + 1);
+    }
+
+    virtual int footprint() const
+    {
+        return L->footprint() + 1;
+    }
+
     virtual void doc(std::ostream& out) const
     {
         out << "gradient " << mode;
@@ -26,7 +26,7 @@ public:
     solid(int height, int width, double value)
         : height(height), width(width), value(value) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return value;
     }
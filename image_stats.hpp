@@ -0,0 +1,362 @@
+// RAWK Copyright (C) 2014 Robert Kooima
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITH-
+// OUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+
+#ifndef IMAGE_STATS_HPP
+#define IMAGE_STATS_HPP
+
+//------------------------------------------------------------------------------
+
+/// Image statistics
+
+class stats : public image
+{
+public:
+    /// Pass image *L* through unaltered and, when processed, write statistics
+    /// of its samples to a JSON file named *name*, or to standard output if
+    /// *name* is "-". The minimum, maximum, mean, and standard deviation of
+    /// each channel are given along with a histogram spanning its range and a
+    /// selection of percentiles found from it. Only every *stride*th row and
+    /// column is examined, which gives a quick estimate of a large image.
+
+    stats(std::string name, int stride, image *L)
+        : image(L), name(name), stride(std::max(1, stride)), seen(-1) { }
+
+    virtual real eval(int i, int j, int k) const
+    {
+        return L->get(i, j, k);
+    }
+
+    virtual void process()
+    {
+        image::process();
+        measure();
+
+        if (name == "-")
+            report(std::cout);
+        else
+        {
+            std::ofstream out(name.c_str());
+
+            if (out)
+                report(out);
+            else
+                throw std::runtime_error("Failed to open " + name);
+        }
+    }
+
+    virtual void doc(std::ostream& out) const
+    {
+        out << "stats " << name << " " << stride;
+    }
+
+protected:
+    static const int bins = 1024;
+
+    std::string name;
+    int         stride;
+
+    // Sample count, and per-channel range, moments, and histogram.
+
+    double              count;
+    std::vector<double> lo;
+    std::vector<double> hi;
+    std::vector<double> mean;
+    std::vector<double> dev;
+    std::vector<double> hist;
+
+    /// Return the *p*th percentile of channel *k*, interpolated within the
+    /// histogram bin in which it falls.
+
+    double percentile(int k, double p) const
+    {
+        const double *H = &hist[size_t(k) * bins];
+        const double  t = p * count / 100.0;
+        const double  w = (hi[k] - lo[k]) / bins;
+
+        double c = 0;
+
+        for (int b = 0; b < bins; ++b)
+            if (H[b] > 0 && c + H[b] >= t)
+                return lo[k] + w * (b + std::max(0.0, t - c) / H[b]);
+            else
+                c += H[b];
+
+        return hi[k];
+    }
+
+    /// Derive parameters from the statistics once they are known.
+
+    virtual void configure() { }
+
+    /// Scan *L* unless that has been done since *L* was last modified.
+
+    void measure()
+    {
+        if (seen != L->get_changes())
+        {
+            analyze();
+            configure();
+            seen = L->get_changes();
+        }
+    }
+
+private:
+    int seen;  ///< Modification count of L at the last scan
+
+    /// Scan *L* twice, first for the range and moments of each channel and
+    /// then for its histogram over that range.
+
+    void analyze()
+    {
+        const int d = L->get_depth();
+
+        count = 0;
+        lo  .assign(d,  std::numeric_limits<double>::max());
+        hi  .assign(d, -std::numeric_limits<double>::max());
+        mean.assign(d, 0.0);
+        dev .assign(d, 0.0);
+        hist.assign(size_t(d) * bins, 0.0);
+
+        scan(false);
+        scan(true);
+    }
+
+    /// Accumulate one pass over the sampled rows of *L*. Rows are gathered in
+    /// parallel in blocks whose number does not depend on the thread count,
+    /// and the blocks are merged in order, so the result is reproducible. A
+    /// band of blocks is advised while the band before it is scanned.
+
+    void scan(bool histogram)
+    {
+        const int h = L->get_height();
+        const int w = L->get_width ();
+        const int d = L->get_depth ();
+        const int r = (h + stride - 1) / stride;
+        const int m = histogram ? d * bins : 4 * d;
+
+        if (r == 0 || w == 0)
+            return;
+
+        // Moments are taken relative to the first sample, for stability.
+
+        std::vector<real> z(d);
+
+        L->get_pixel(0, 0, &z.front());
+
+        const int g = std::max(16, (r + 255) / 256);
+        const int n = (r + g - 1) / g;
+        const int q = 4 * omp_get_max_threads();
+
+        std::vector<double> part(size_t(n) * m, 0.0);
+
+        L->advise(0, 0, std::min(q * g * stride, h), w);
+
+        for (int a = 0; a < n; a += q)
+        {
+            const int b = std::min(a + q, n);
+
+            L->advise(b * g * stride, 0, std::min((b + q) * g * stride, h), w);
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int u = a; u < b; ++u)
+            {
+                std::vector<real> x(d);
+
+                double *P = &part[size_t(u) * m];
+
+                if (!histogram)
+                    for (int k = 0; k < d; ++k)
+                    {
+                        P[4 * k + 0] =  std::numeric_limits<double>::max();
+                        P[4 * k + 1] = -std::numeric_limits<double>::max();
+                    }
+
+                for     (int i = u * g; i < std::min(u * g + g, r); ++i)
+                    for (int j = 0;     j < w;                      j += stride)
+                    {
+                        L->get_pixel(i * stride, j, &x.front());
+
+                        for (int k = 0; k < d; ++k)
+                            if (histogram)
+                                P[k * bins + bin(k, x[k])] += 1;
+                            else
+                            {
+                                const double y = x[k] - z[k];
+
+                                P[4 * k + 0]  = std::min(P[4 * k + 0], double(x[k]));
+                                P[4 * k + 1]  = std::max(P[4 * k + 1], double(x[k]));
+                                P[4 * k + 2] += y;
+                                P[4 * k + 3] += y * y;
+                            }
+                    }
+            }
+        }
+
+        // Merge the blocks in order.
+
+        if (histogram)
+        {
+            for     (int u = 0; u < n; ++u)
+                for (int k = 0; k < m; ++k)
+                    hist[k] += part[size_t(u) * m + k];
+        }
+        else
+        {
+            std::vector<double> s(d, 0.0);
+            std::vector<double> t(d, 0.0);
+
+            for     (int u = 0; u < n; ++u)
+                for (int k = 0; k < d; ++k)
+                {
+                    const double *P = &part[size_t(u) * m];
+
+                    lo[k] = std::min(lo[k], P[4 * k + 0]);
+                    hi[k] = std::max(hi[k], P[4 * k + 1]);
+                    s[k] += P[4 * k + 2];
+                    t[k] += P[4 * k + 3];
+                }
+
+            count = double(r) * double((w + stride - 1) / stride);
+
+            for (int k = 0; k < d; ++k)
+            {
+                mean[k] = z[k] + s[k] / count;
+                dev [k] = sqrt(std::max(0.0, (t[k] - s[k] * s[k] / count)
+                                           / std::max(count - 1, 1.0)));
+            }
+        }
+    }
+
+    /// Return the histogram bin of value *v* in channel *k*.
+
+    int bin(int k, double v) const
+    {
+        if (hi[k] > lo[k])
+            return std::min(bins - 1, int(bins * (v - lo[k]) / (hi[k] - lo[k])));
+        else
+            return 0;
+    }
+
+    /// Write the statistics as JSON.
+
+    void report(std::ostream& out) const
+    {
+        static const double p[] = { 0.1, 1, 5, 25, 50, 75, 95, 99, 99.9 };
+
+        const int d = L->get_depth();
+
+        out << std::setprecision(9)
+            << "{\n"
+            << "  \"height\": " << L->get_height() << ",\n"
+            << "  \"width\": "  << L->get_width () << ",\n"
+            << "  \"depth\": "  << d               << ",\n"
+            << "  \"stride\": " << stride          << ",\n"
+            << "  \"count\": "  << count           << ",\n"
+            << "  \"channels\": [\n";
+
+        for (int k = 0; k < d; ++k)
+        {
+            out << "    {\n"
+                << "      \"min\": "    << lo  [k] << ",\n"
+                << "      \"max\": "    << hi  [k] << ",\n"
+                << "      \"mean\": "   << mean[k] << ",\n"
+                << "      \"stddev\": " << dev [k] << ",\n"
+                << "      \"percentiles\": {";
+
+            for (int c = 0; c < int(sizeof (p) / sizeof (double)); ++c)
+                out << (c ? ", " : " ") << "\"" << p[c] << "\": "
+                    << percentile(k, p[c]);
+
+            out << " },\n"
+                << "      \"histogram\": [";
+
+            for (int b = 0; b < bins; ++b)
+                out << (b ? ", " : "") << hist[size_t(k) * bins + b];
+
+            out << "]\n"
+                << "    }" << (k + 1 < d ? "," : "") << "\n";
+        }
+        out << "  ]\n"
+            << "}\n";
+    }
+};
+
+//------------------------------------------------------------------------------
+
+/// Automatic level filter
+
+class autolevel : public stats
+{
+public:
+    /// Linearly map each channel of image *L* so that its *low*th percentile
+    /// becomes zero and its *high*th percentile becomes one. This is the bias
+    /// and gain that would otherwise be found by trial and error. Percentiles
+    /// are estimated as by ::stats, examining every *stride*th row and column,
+    /// when this image is processed or prepared for preview, and estimated
+    /// again after any image below this one is modified.
+
+    autolevel(double low, double high, int stride, image *L)
+        : stats("-", stride, L), low(low), high(high) { }
+
+    virtual real eval(int i, int j, int k) const
+    {
+        if (0 <= k && k < int(offset.size()))
+            return (L->get(i, j, k) - offset[k]) * scale[k];
+        else
+            return 0.0;
+    }
+
+    virtual void prepare()
+    {
+        image::prepare();
+        measure();
+    }
+
+    virtual void process()
+    {
+        image::process();
+        measure();
+    }
+
+    virtual void doc(std::ostream& out) const
+    {
+        out << "autolevel " << low << " " << high << " " << stride;
+    }
+
+private:
+    double low;
+    double high;
+
+    std::vector<double> offset;
+    std::vector<double> scale;
+
+    virtual void configure()
+    {
+        const int d = L->get_depth();
+
+        offset.resize(d);
+        scale .resize(d);
+
+        for (int k = 0; k < d; ++k)
+        {
+            const double a = percentile(k, low);
+            const double b = percentile(k, high);
+
+            offset[k] = a;
+            scale [k] = (b > a) ? 1.0 / (b - a) : 1.0;
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+
+#endif
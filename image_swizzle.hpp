@@ -50,11 +50,39 @@ public:
         }
     }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         return L->get(i, j, index[k]);
     }
 
+    /// Fetch a whole pixel of *L* and reorder it. Wider inputs are fetched
+    /// a channel at a time.
+
+    virtual void pixel(int i, int j, real *v) const
+    {
+        real u[36];
+
+        if (L->channels() > 36)
+            image::pixel(i, j, v);
+        else
+        {
+            L->get_pixel(i, j, u);
+
+            for (size_t k = 0; k < index.size(); ++k)
+                v[k] = u[index[k]];
+        }
+    }
+
+    virtual bool copies(const std::type_info& t) const
+    {
+        return L->copies(t);
+    }
+
+    virtual const raw *locate(int& i, int& j, int& k, int& n) const
+    {
+        return L->locate(i, j, k = index[k], n);
+    }
+
     virtual int get_depth() const
     {
         return index.size();
@@ -27,7 +27,7 @@ public:
 
     threshold(double value, image *L) : image(L), value(value) { }
 
-    virtual double get(int i, int j, int k) const
+    virtual real eval(int i, int j, int k) const
     {
         if (L->get(i, j, k) > value)
             return 1.0;
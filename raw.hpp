@@ -18,10 +18,25 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <zlib.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 extern int errno;
 
@@ -34,8 +49,10 @@ extern int errno;
 ///     uint16_t ... u U
 ///      int32_t ... i I
 ///     uint32_t ... l L
+///         half ... h H
 ///        float ... f F
 ///       double ... d D
+///        1-bit ... m
 
 //------------------------------------------------------------------------------
 
@@ -50,6 +67,13 @@ typedef uint32_t *uint32_p;
 typedef  float   * float_p;
 typedef double   *double_p;
 
+/// Storage of a half precision floating point sample
+
+struct float16
+{
+    uint16_t bits;
+};
+
 //------------------------------------------------------------------------------
 
 /// RAW image file I/O error
@@ -63,67 +87,492 @@ public :
 
 //------------------------------------------------------------------------------
 
+/// Header of a tiled RAW file, in native byte order
+
+struct raw_header
+{
+    char     magic[4];   ///< "RAWT" or "RAWZ"
+    uint32_t tile;       ///< Tile width and height in pixels
+    uint32_t height;     ///< Image height in pixels
+    uint32_t width;      ///< Image width in pixels
+    uint32_t depth;      ///< Channels per pixel
+    uint32_t size;       ///< Bytes per sample
+};
+
+//------------------------------------------------------------------------------
+
+/// Band of rows staged in memory for bulk transfer to or from a RAW file
+
+struct raw_band
+{
+    raw_band() : i0(0), i1(0), data(0), base(0), capacity(0),
+                 a(0), b(0), file(-1), direct(-1), write(false),
+                 busy(false), error(0) { }
+
+    int       i0;        ///< First row held
+    int       i1;        ///< One past the last row held
+    uint8_t  *data;      ///< Aligned buffer
+    size_t    base;      ///< File offset of the first byte of the buffer
+    size_t    capacity;  ///< Size of the buffer in bytes
+
+    size_t    a;         ///< File offset of the first byte to transfer
+    size_t    b;         ///< File offset of the last byte to transfer plus one
+    int       file;      ///< File descriptor for buffered transfers
+    int       direct;    ///< File descriptor for direct transfers, or -1
+    bool      write;     ///< Transfer from the buffer to the file?
+
+    pthread_t thread;    ///< Thread performing the transfer
+    bool      busy;      ///< Transfer in progress?
+    int       error;     ///< Error number of a failed transfer
+};
+
+//------------------------------------------------------------------------------
+
+/// Per-thread cache of decompressed blocks of a compressed RAW file
+
+struct raw_cache
+{
+    raw_cache() : serial(0), last(0), next(0) { }
+
+    long serial;  ///< Serial number of the file cached
+
+    std::vector<int>                   tiles;   ///< Block held by each slot
+    std::vector<std::vector<uint8_t> > slots;   ///< Decompressed blocks
+    std::vector<uint8_t>               packed;  ///< Compressed block buffer
+
+    int last;  ///< Most recently used slot
+    int next;  ///< Next slot to be replaced
+};
+
+//------------------------------------------------------------------------------
+
 /// RAW image file
+///
+/// All files are mapped into memory. With the default 'm' #backend, all
+/// access goes through that mapping. With the 'r' backend, a batch process
+/// instead streams bands of rows through aligned buffers using pread and
+/// pwrite on background threads, falling back to the mapping only for samples
+/// outside of the current band. The 'd' backend does the same but opens the
+/// file for direct I/O where supported, bypassing the page cache. Bands are
+/// swapped by each advice, so these backends are only for a batch process,
+/// which advises from one thread between parallel passes.
+///
+/// Samples are stored in one of several layouts. With the 'p' layout, pixels
+/// are interleaved in row-major order (BIP). With the 'l' layout, each row is
+/// stored as one line per channel (BIL). With the 'q' layout, each channel is
+/// stored as a separate row-major plane (BSQ), so operations on one channel
+/// touch only the pages of that plane. With the 't' layout, the file begins
+/// with a raw_header padded to 16 KB, a whole number of pages on common
+/// systems, followed by square tiles of #tile_size pixels, each stored in the
+/// 'p' layout, themselves in row-major order. Edge tiles are stored whole.
+/// This keeps vertical neighbors on the same page.
+///
+/// The 'z' layout is a compressed container of the same tiles. The
+/// header is followed by an index giving the offset and length of each tile,
+/// and then by the tiles, each compressed independently using zlib. A tile of
+/// zero length is all zeros. Tiles are decompressed on demand into a cache
+/// private to each thread. The file is written a band of whole tile rows at a
+/// time, compressing the tiles of each band in parallel.
 
 class raw
 {
 public:
-    raw(std::string name, size_t start, size_t height, size_t width, size_t depth, size_t size, bool write) :
+    raw(std::string name, size_t start, size_t height, size_t width, size_t depth, size_t size, bool write, char layout) :
         name(name),
         start(start),
         height(height),
         width(width),
         depth(depth),
         size(size),
+        layout(layout),
+        shift(0),
+        across(width),
+        length(0),
+        columns(width),
+        channels(depth),
+        packed(false),
         file(0),
+        direct(-1),
         buffer(0),
-        pixels(0)
+        pixels(0),
+        front(bands + 0),
+        back (bands + 1),
+        slots(0),
+        serial(0)
     {
-        size_t length = start + height * width * depth * size;
-
         int mode = write ? O_RDWR | O_TRUNC | O_CREAT : O_RDONLY;
         int prot = write ? PROT_READ | PROT_WRITE : PROT_READ;
 
         if ((file = open(name.c_str(), mode, 0666)) == -1)
             throw raw_error(name, strerror(errno));
 
+        if (layout == 't' || layout == 'z')
+            tiles(write);
+
+        if (layout == 'z')
+        {
+            blocks(write);
+            return;
+        }
+
+        length = this->start + planes() * extent(height, true);
+
         if (write && ftruncate(file, length) == -1)
             throw raw_error(name, strerror(errno));
 
+        if (write && layout == 't')
+            header();
+
         if ((buffer = mmap(0, length, prot, MAP_SHARED, file, 0)) == MAP_FAILED)
             throw raw_error(name, strerror(errno));
 
-        pixels = uint8_p(buffer) + start;
+        pixels = uint8_p(buffer) + this->start;
+
+        if (pattern != MADV_NORMAL)
+            madvise(buffer, length, pattern);
+
+#ifdef O_DIRECT
+        if (backend == 'd')
+            if ((direct = open(name.c_str(), (mode & ~(O_TRUNC | O_CREAT))
+                                                     | O_DIRECT)) == -1)
+                throw raw_error(name, strerror(errno));
+#endif
     }
 
     virtual void   put(int, int, int, double) = 0;
     virtual double get(int, int, int) const   = 0;
 
+    /// Decode the samples of pixels *j0* through *j1* - 1 of row *i* to *p*,
+    /// pixel-interleaved, in double or single precision.
+
+    virtual void get_row(int i, int j0, int j1, double *p) const
+    {
+        get_samples(i, j0, j1, p);
+    }
+    virtual void get_row(int i, int j0, int j1, float *p) const
+    {
+        get_samples(i, j0, j1, p);
+    }
+
+    /// Encode pixel-interleaved samples from *p* to pixels *j0* through
+    /// *j1* - 1 of row *i*, in double or single precision.
+
+    virtual void put_row(int i, int j0, int j1, const double *p)
+    {
+        put_samples(i, j0, j1, p);
+    }
+    virtual void put_row(int i, int j0, int j1, const float *p)
+    {
+        put_samples(i, j0, j1, p);
+    }
+
+    /// Advise that rows *i0* through *i1* - 1 and columns *j0* through *j1* - 1
+    /// will soon be read. The region must lie in the file. With the mapping
+    /// backend, the kernel is asked to page the region in. Otherwise, the rows
+    /// of the previous advice become the current band and the given rows are
+    /// read in the background, to become current at the next advice. An empty
+    /// region simply promotes the previous advice.
+
+    void advise(int i0, int j0, int i1, int j1) const
+    {
+        if (packed)
+        {
+            j0 = int((size_t(j0) * channels    ) / 8);
+            j1 = int((size_t(j1) * channels + 7) / 8);
+        }
+        if (layout == 'z')
+        {
+#ifdef POSIX_FADV_WILLNEED
+            // Advise the compressed data of each tile.
+
+            const int m = (1 << shift) - 1;
+
+            for     (int i = i0 & ~m; i < i1 && j0 < j1; i += m + 1)
+                for (int j = j0 & ~m; j < j1;            j += m + 1)
+                {
+                    const size_t t = (i >> shift) * across + (j >> shift);
+
+                    if (index[2 * t + 1])
+                        posix_fadvise(file, index[2 * t], index[2 * t + 1],
+                                      POSIX_FADV_WILLNEED);
+                }
+#endif
+        }
+        else if (layout == 'q')
+        {
+            // Band-sequential reads may need any or all bands, so leave them
+            // to demand paging rather than advise unneeded bands.
+        }
+        else if (layout == 'l')
+        {
+            const size_t page = size_t(sysconf(_SC_PAGESIZE));
+
+            // Advise the lines of all bands of the rows at once.
+
+            size_t a = start + extent(i0, false);
+            size_t b = start + extent(i1, true);
+
+            a -= a % page;
+
+            if (i0 < i1 && j0 < j1)
+                madvise(uint8_p(buffer) + a, b - a, MADV_WILLNEED);
+        }
+        else if (!staged())
+        {
+            const uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+
+            // Advise each row, or each row of tiles.
+
+            const int    m = (1 << shift) - 1;
+            const size_t n = (depth * size) << (2 * shift);
+
+            for (int i = i0 & ~m; i < i1 && j0 < j1; i += m + 1)
+            {
+                uintptr_t a = uintptr_t(map(i, j0       & ~m));
+                uintptr_t b = uintptr_t(map(i, (j1 - 1) & ~m)) + n;
+
+                a -= a % page;
+
+                madvise((void *) a, b - a, MADV_WILLNEED);
+            }
+        }
+        else
+        {
+            finish(*back);
+
+            if (back->i0 < back->i1)
+                std::swap(front, back);
+
+            if (i0 < i1 && !(front->i0 <= i0 && i1 <= front->i1))
+                begin(*back, i0, i1, false);
+            else
+                back->i0 = back->i1 = 0;
+        }
+    }
+
+    /// Prepare rows *i0* through *i1* - 1 to be written as the current band.
+    /// This has no effect with the mapping backend.
+
+    void stage(int i0, int i1)
+    {
+        if (staged())
+        {
+            std::swap(front, back);
+            finish(*front);
+            reserve(*front, i0, i1);
+
+            // Clear the edge tiles of a tiled or compressed band, whose
+            // padding is otherwise left as it was by the previous band.
+
+            if (layout == 't' || layout == 'z')
+                memset(front->data, 0, front->capacity);
+        }
+    }
+
+    /// Begin writing rows *i0* through *i1* - 1 back to the file, without
+    /// waiting for completion. Blocks of zeros are left as holes in the file,
+    /// or as empty tiles in a compressed file.
+
+    void writeback(int i0, int i1)
+    {
+        if (layout == 'z')
+            deflate(i0, i1);
+        else if (staged())
+            begin(*front, i0, i1, true);
+        else
+        {
+            for (int k = 0; k < planes(); ++k)
+            {
+                const size_t a = start + plane(k) + extent(i0, false);
+                const size_t b = start + plane(k) + extent(i1, true);
+
+                punch(a, b);
+#ifdef SYNC_FILE_RANGE_WRITE
+                sync_file_range(file, a, b - a, SYNC_FILE_RANGE_WRITE);
+#else
+                const size_t page = size_t(sysconf(_SC_PAGESIZE));
+                msync(uint8_p(buffer) + a - a % page, b - a + a % page, MS_ASYNC);
+#endif
+            }
+        }
+    }
+
+    /// Wait for rows *i0* through *i1* - 1 to reach the file, then release
+    /// the pages lying wholly within them from memory.
+
+    void release(int i0, int i1)
+    {
+        if (layout == 'z')
+            return;
+
+        const size_t page = size_t(sysconf(_SC_PAGESIZE));
+
+        if (staged())
+        {
+            if (front->i0 < i1 && i0 < front->i1) finish(*front);
+            if (back ->i0 < i1 && i0 < back ->i1) finish(*back);
+        }
+        for (int k = 0; k < planes(); ++k)
+        {
+            size_t a = start + plane(k) + extent(i0, false);
+            size_t b = start + plane(k) + extent(i1, true);
+#ifdef SYNC_FILE_RANGE_WRITE
+            sync_file_range(file, a, b - a, SYNC_FILE_RANGE_WAIT_BEFORE
+                                          | SYNC_FILE_RANGE_WRITE
+                                          | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+            msync(uint8_p(buffer) + a - a % page, b - a + a % page, MS_SYNC);
+#endif
+            a = (a + page - 1) / page * page;
+            b = (b           ) / page * page;
+
+            if (a < b)
+            {
+                madvise(uint8_p(buffer) + a, b - a, MADV_DONTNEED);
+#ifdef POSIX_FADV_DONTNEED
+                posix_fadvise(file, a, b - a, POSIX_FADV_DONTNEED);
+#endif
+            }
+        }
+    }
+
     std::string get_name()   const { return name;   }
     int         get_height() const { return height; }
-    int         get_width()  const { return width;  }
-    int         get_depth()  const { return depth;  }
+    int         get_width()  const { return columns;  }
+    int         get_depth()  const { return channels; }
+    size_t      get_pitch()  const { return width * depth * size; }
+    char        get_layout() const { return layout; }
+    int         get_grain()  const { return 1 << shift; }
+
+    /// Is this file accessed in bulk through staged bands of rows rather than
+    /// through the mapping? The bands of a band-sequential file are not
+    /// contiguous, so it always uses the mapping.
+
+    bool staged() const
+    {
+        return layout == 'z' || (backend != 'm' && layout != 'q');
+    }
+
+    /// Copy *n* samples of channel *c* of file *that*, which must have the
+    /// same sample type, beginning at row *a* column *b*, to channel *k* of
+    /// this file beginning at row *i* column *j*, without conversion. Runs of
+    /// samples that are contiguous in both files are copied in one piece.
+
+    virtual void copy(int i, int j, int k, const raw& that, int a, int b, int c,
+                      int n)
+    {
+        const size_t s =      stride();
+        const size_t t = that.stride();
+
+        while (n > 0)
+        {
+            const int m = std::min(run(j, j + n) - j, that.run(b, b + n) - b);
+
+            uint8_t       *p = uint8_p(     data(i, j, k));
+            const uint8_t *q = (const uint8_t *) that.data(a, b, c);
+
+            if (s == size && t == size)
+                memcpy(p, q, size * m);
+            else
+                for (int x = 0; x < m; ++x)
+                    memcpy(p + s * x, q + t * x, size);
+
+            j += m;
+            b += m;
+            n -= m;
+        }
+    }
+
+    /// Complete any transfer and close the file. A destructor cannot throw,
+    /// so errors are reported to the standard error stream instead.
 
     virtual ~raw()
     {
-        size_t length = start + height * width * depth * size;
+        if (int e = join(*front)) complain(e);
+        if (int e = join(*back))  complain(e);
 
-        if (munmap(buffer, length) == -1)
-            throw raw_error(name, strerror(errno));
+        free(front->data);
+        free(back ->data);
+
+        if (buffer && munmap(buffer, length) == -1)
+            complain(errno);
+
+        if (direct != -1 && close(direct) == -1)
+            complain(errno);
 
         if (close(file) == -1)
-            throw raw_error(name, strerror(errno));
+            complain(errno);
     }
 
+    /// Storage backend of subsequently opened files: 'm' for the memory
+    /// mapping, 'r' for buffered pread and pwrite, 'd' for direct I/O.
+
+    static char backend;
+
+    /// Expected access pattern of subsequently opened files, given as advice
+    /// for madvise: MADV_SEQUENTIAL for batch processing, where readahead
+    /// helps and pages may be dropped behind, or MADV_RANDOM for interactive
+    /// previews, where readahead is wasted and explicit advice suffices.
+
+    static int pattern;
+
+    /// Tile size of subsequently written tiled files, a power of two.
+
+    static int tile_size;
+
+    /// Total size in bytes of the decompressed block caches of each
+    /// subsequently opened compressed file, shared among all threads.
+
+    static size_t cache_size;
+
 protected:
 
     const void *data(int i, int j, int k) const
     {
-        return (const uint8_t *) pixels + (((i * width) + j) * depth + k) * size;
+        if (front->i0 <= i && i < front->i1)
+            return front->data + (start + offset(i, j, k) - front->base);
+        else if (layout == 'z')
+            return block(i, j) + local(i, j, k);
+        else
+            return (const uint8_t *) pixels + offset(i, j, k);
     }
     void *data(int i, int j, int k)
     {
-        return       (uint8_t *) pixels + (((i * width) + j) * depth + k) * size;
+        if (front->i0 <= i && i < front->i1)
+            return front->data + (start + offset(i, j, k) - front->base);
+        else if (layout == 'z')
+            throw raw_error(name, "Row is not in the current band");
+        else
+            return       (uint8_t *) pixels + offset(i, j, k);
+    }
+
+    template <typename R> void get_samples(int i, int j0, int j1, R *p) const
+    {
+        for     (int j = j0; j < j1; ++j)
+            for (int k = 0; k < get_depth(); ++k)
+                *p++ = R(get(i, j, k));
+    }
+    template <typename R> void put_samples(int i, int j0, int j1, const R *p)
+    {
+        for     (int j = j0; j < j1; ++j)
+            for (int k = 0; k < get_depth(); ++k)
+                put(i, j, k, *p++);
+    }
+
+    /// Return the end of the run of pixels from *j* to at most *j1* - 1 that
+    /// are stored contiguously in one row, ending at the edge of a tile.
+
+    int run(int j, int j1) const
+    {
+        return shift ? std::min(j1, ((j >> shift) + 1) << shift) : j1;
+    }
+
+    /// Return the distance in bytes between samples of one channel in
+    /// successive columns of a run.
+
+    size_t stride() const
+    {
+        return (layout == 'l' || layout == 'q') ? size : depth * size;
     }
 
     std::string name;
@@ -133,27 +582,646 @@ protected:
     size_t width;
     size_t depth;
     size_t size;
+    char   layout;
+    int    shift;
+    size_t across;
+    size_t length;
+    size_t columns;      ///< Width of the image, in pixels
+    size_t channels;     ///< Depth of the image, in samples
+    bool   packed;       ///< Samples are bits packed into bytes?
     int    file;
+    int    direct;
     void  *buffer;
     void  *pixels;
+
+private:
+
+    raw_band bands[2];
+
+    mutable raw_band *front;
+    mutable raw_band *back;
+
+    std::vector<uint64_t> index;   ///< Offset and length of each tile
+    size_t                tail;    ///< End of the compressed data
+    size_t                slots;   ///< Tiles cached by each thread
+    long                  serial;  ///< Serial number of a compressed file
+
+    static long serials;
+
+    /// Block caches of each thread, most recently used file first. These are
+    /// reached through a thread-specific key, rather than by OpenMP thread
+    /// number, because threads of separate teams share numbers. The caches
+    /// of a thread are deleted when it exits.
+
+    static const size_t files = 8;
+
+    static pthread_key_t  caches;
+    static pthread_once_t caches_once;
+
+    static void caches_create()
+    {
+        pthread_key_create(&caches, caches_delete);
+    }
+    static void caches_delete(void *p)
+    {
+        delete (std::vector<raw_cache> *) p;
+    }
+
+    /// Direct I/O offset, length, and buffer alignment
+
+    static const size_t align = 4096;
+
+    /// Size of the header of a tiled or compressed file, a whole number of
+    /// pages on both 4K- and 16K-page systems.
+
+    static const size_t leader = 16384;
+
+    const void *map(int i, int j) const
+    {
+        return (const uint8_t *) pixels + offset(i, j, 0);
+    }
+
+    /// Return the offset of sample *i*, *j*, *k* from the first sample.
+
+    size_t offset(int i, int j, int k) const
+    {
+        if (shift)
+        {
+            const int m = (1 << shift) - 1;
+
+            return ((((size_t(i >> shift) * across + (j >> shift)) << shift
+                                          | (i & m)) << shift
+                                          | (j & m)) * depth + k) * size;
+        }
+        else if (layout == 'q')
+            return ((size_t(k) * height + i) * width + j) * size;
+        else if (layout == 'l')
+            return ((size_t(i) * depth  + k) * width + j) * size;
+        else
+            return ((size_t(i) * width  + j) * depth + k) * size;
+    }
+
+    /// Return the number of separately stored planes and the offset of the
+    /// plane holding channel *k*. Only band-sequential files have more than
+    /// one.
+
+    int planes() const
+    {
+        return (layout == 'q') ? depth : 1;
+    }
+
+    size_t plane(int k) const
+    {
+        return (layout == 'q') ? k * height * width * size : 0;
+    }
+
+    /// Return the offset of the storage of row *i* from the first sample,
+    /// rounded *up* or down to a whole row of tiles.
+
+    size_t extent(int i, bool up) const
+    {
+        const int m = (1 << shift) - 1;
+
+        if (up) i += m;
+
+        return offset((i >> shift) << shift, 0, 0);
+    }
+
+    /// Determine the tile geometry of a tiled file, either from the static
+    /// tile size if *write* or from the file header otherwise.
+
+    void tiles(bool write)
+    {
+        raw_header h;
+
+        if (write)
+            h.tile = tile_size;
+        else
+        {
+            if (pread(file, &h, sizeof (h), start) != ssize_t(sizeof (h)))
+                throw raw_error(name, "Failed to read tile header");
+
+            if (memcmp(h.magic, magic(), 4) || h.height != height
+                                           || h.width  != width
+                                           || h.depth  != depth
+                                           || h.size   != size)
+                throw raw_error(name, "Tile header does not match");
+        }
+        if (h.tile == 0 || (h.tile & (h.tile - 1)))
+            throw raw_error(name, "Tile size is not a power of two");
+
+        while ((1U << shift) < h.tile)
+            shift++;
+
+        across = (width + h.tile - 1) >> shift;
+        start  = start + leader;
+    }
+
+    /// Write the header of a tiled file.
+
+    void header()
+    {
+        raw_header h;
+
+        memcpy(h.magic, magic(), 4);
+        h.tile   = 1 << shift;
+        h.height = height;
+        h.width  = width;
+        h.depth  = depth;
+        h.size   = size;
+
+        if (pwrite(file, &h, sizeof (h), start - leader) != ssize_t(sizeof (h)))
+            throw raw_error(name, strerror(errno));
+    }
+
+    const char *magic() const
+    {
+        return (layout == 'z') ? "RAWZ" : "RAWT";
+    }
+
+    /// Return the offset of sample *i*, *j*, *k* from the first sample of its
+    /// tile.
+
+    size_t local(int i, int j, int k) const
+    {
+        const int m = (1 << shift) - 1;
+
+        return ((size_t((i & m) << shift | (j & m))) * depth + k) * size;
+    }
+
+    /// Return the size in bytes of one tile.
+
+    size_t tile_bytes() const
+    {
+        return (depth * size) << (2 * shift);
+    }
+
+    /// Initialize the index and caches of a compressed file, either writing
+    /// an empty index if *write* or reading the index otherwise.
+
+    void blocks(bool write)
+    {
+        const size_t down  = (height + (1 << shift) - 1) >> shift;
+        const size_t count = down * across;
+        const size_t bytes = count * 2 * sizeof (uint64_t);
+
+        index.assign(2 * count, 0);
+        tail = start + bytes;
+
+        if (write)
+        {
+            header();
+
+            if (pwrite(file, &index.front(), bytes, start) != ssize_t(bytes))
+                throw raw_error(name, strerror(errno));
+        }
+        else
+        {
+            if (pread (file, &index.front(), bytes, start) != ssize_t(bytes))
+                throw raw_error(name, "Failed to read block index");
+        }
+
+        // Divide the cache among the threads.
+
+#ifdef _OPENMP
+        const size_t threads = omp_get_max_threads();
+#else
+        const size_t threads = 1;
+#endif
+        slots  = std::max(size_t(2), cache_size / tile_bytes() / threads);
+        serial = ++serials;
+    }
+
+    /// Return the block cache of the calling thread for this file, replacing
+    /// that of the least recently used file if necessary.
+
+    raw_cache& cache() const
+    {
+        pthread_once(&caches_once, caches_create);
+
+        std::vector<raw_cache> *v = (std::vector<raw_cache> *)
+                                        pthread_getspecific(caches);
+        if (v == 0)
+            pthread_setspecific(caches, v = new std::vector<raw_cache>());
+
+        if (!v->empty() && v->front().serial == serial)
+            return v->front();
+
+        size_t n;
+
+        for (n = 0; n < v->size(); ++n)
+            if ((*v)[n].serial == serial)
+                break;
+
+        if (n == v->size())
+        {
+            if (n < files)
+                v->push_back(raw_cache());
+            else
+                n--;
+
+            raw_cache& c = (*v)[n];
+
+            c.serial = serial;
+            c.last   = 0;
+            c.next   = 0;
+            c.tiles.assign(slots, -1);
+            c.slots.resize(slots);
+        }
+        std::rotate(v->begin(), v->begin() + n, v->begin() + n + 1);
+
+        return v->front();
+    }
+
+    /// Return the decompressed tile containing pixel *i*, *j*.
+
+    const uint8_t *block(int i, int j) const
+    {
+        const int t = int((i >> shift) * across + (j >> shift));
+
+        raw_cache& c = cache();
+
+        if (c.tiles[c.last] == t)
+            return &c.slots[c.last].front();
+
+        for (int s = 0; s < int(c.tiles.size()); ++s)
+            if (c.tiles[s] == t)
+                return &c.slots[c.last = s].front();
+
+        // Replace the next slot in turn with the needed tile.
+
+        const int s = c.next;
+
+        c.next = (c.next + 1) % c.tiles.size();
+        c.last = s;
+
+        inflate(t, c.slots[s], c.packed);
+        c.tiles[s] = t;
+
+        return &c.slots[s].front();
+    }
+
+    /// Decompress tile *t* into *data* using *packed* as scratch.
+
+    void inflate(int t, std::vector<uint8_t>& data,
+                        std::vector<uint8_t>& packed) const
+    {
+        const size_t n = tile_bytes();
+        const size_t o = index[2 * t];
+        const size_t l = index[2 * t + 1];
+
+        data.resize(n);
+
+        if (l == 0)
+            std::fill(data.begin(), data.end(), 0);
+        else
+        {
+            uLongf d = n;
+
+            packed.resize(l);
+
+            if (pread(file, &packed.front(), l, o) != ssize_t(l))
+                throw raw_error(name, "Failed to read block");
+
+            if (uncompress(&data.front(), &d, &packed.front(), l) != Z_OK || d != n)
+                throw raw_error(name, "Corrupt block");
+        }
+    }
+
+    /// Compress the tiles of rows *i0* through *i1* - 1 from the current band
+    /// in parallel, append them to the file, and update the index.
+
+    void deflate(int i0, int i1)
+    {
+        const size_t n  = tile_bytes();
+        const int    t0 = int(extent(i0, false) / n);
+        const int    t1 = int(extent(i1, true)  / n);
+
+        std::vector<std::vector<uint8_t> > packed(t1 - t0);
+        bool failed = false;
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int t = t0; t < t1; ++t)
+        {
+            const uint8_t *p = front->data + (start + t * n - front->base);
+
+            uLongf l = compressBound(n);
+
+            if (zero(p, n))
+                continue;
+
+            packed[t - t0].resize(l);
+
+            if (compress2(&packed[t - t0].front(), &l, p, n, Z_BEST_SPEED) == Z_OK)
+                packed[t - t0].resize(l);
+            else
+                failed = true;
+        }
+        if (failed)
+            throw raw_error(name, "Failed to compress block");
+
+        // Append the tiles and write their entries of the index.
+
+        for (int t = t0; t < t1; ++t)
+        {
+            const size_t l = packed[t - t0].size();
+
+            if (l && pwrite(file, &packed[t - t0].front(), l, tail) != ssize_t(l))
+                throw raw_error(name, strerror(errno));
+
+            index[2 * t    ] = tail;
+            index[2 * t + 1] = l;
+            tail += l;
+        }
+
+        const size_t bytes = size_t(t1 - t0) * 2 * sizeof (uint64_t);
+        const size_t where = size_t(t0)      * 2 * sizeof (uint64_t);
+
+        if (t0 < t1 && pwrite(file, &index[2 * t0], bytes, start + where)
+                                                         != ssize_t(bytes))
+            throw raw_error(name, strerror(errno));
+    }
+
+    /// Make band *n* the buffer for rows *i0* through *i1* - 1, aligning its
+    /// file range outward for direct I/O.
+
+    void reserve(raw_band& n, int i0, int i1) const
+    {
+        const size_t a = start + extent(i0, false);
+        const size_t b = start + extent(i1, true);
+
+        n.base = a - a % align;
+
+        const size_t c = (b - n.base + align - 1) / align * align;
+
+        if (n.capacity < c)
+        {
+            void *p;
+
+            if (posix_memalign(&p, align, c))
+                throw raw_error(name, "Failed to allocate band buffer");
+
+            free(n.data);
+            n.data     = (uint8_t *) p;
+            n.capacity = c;
+        }
+        n.i0     = i0;
+        n.i1     = i1;
+        n.a      = a;
+        n.b      = b;
+        n.file   = file;
+        n.direct = direct;
+    }
+
+    /// Begin transferring rows *i0* through *i1* - 1 between band *n* and the
+    /// file on a background thread.
+
+    void begin(raw_band& n, int i0, int i1, bool write) const
+    {
+        finish(n);
+
+        if (!write)
+            reserve(n, i0, i1);
+
+        n.write = write;
+        n.error = 0;
+
+        if (pthread_create(&n.thread, 0, transfer_main, &n))
+            throw raw_error(name, "Failed to start I/O thread");
+
+        n.busy = true;
+    }
+
+    /// Wait for any transfer of band *n* to complete, throwing if it failed.
+
+    void finish(raw_band& n) const
+    {
+        if (int e = join(n))
+            throw raw_error(name, strerror(e));
+    }
+
+    /// Wait for any transfer of band *n* to complete and return its error
+    /// number, or zero if it succeeded.
+
+    int join(raw_band& n) const
+    {
+        if (n.busy)
+        {
+            pthread_join(n.thread, 0);
+            n.busy = false;
+
+            return n.error;
+        }
+        return 0;
+    }
+
+    /// Report error number *e* where it cannot be thrown.
+
+    void complain(int e) const
+    {
+        std::cerr << name << ": " << strerror(e) << std::endl;
+    }
+
+    /// Transfer bytes *a* through *b* - 1 of band *n* using file *f*.
+
+    static bool transfer(raw_band *n, int f, size_t a, size_t b)
+    {
+        while (a < b)
+        {
+            ssize_t c = n->write ? pwrite(f, n->data + a - n->base, b - a, a)
+                                 : pread (f, n->data + a - n->base, b - a, a);
+            if (c > 0)
+                a += c;
+            else if (c == 0 && !n->write)
+                break;
+            else if (errno != EINTR)
+                return false;
+        }
+        return true;
+    }
+
+    /// Transfer bytes *a* through *b* - 1 of band *n*. Direct I/O handles the
+    /// aligned interior, while any unaligned head and tail go through the page
+    /// cache.
+
+    static bool transfer(raw_band *n, size_t a, size_t b)
+    {
+        if (n->direct != -1)
+        {
+            size_t c = (a + align - 1) / align * align;
+            size_t d = (b            ) / align * align;
+
+            if (c < d)
+            {
+                if (!n->write)
+                {
+                    c = a - a % align;
+                    d = (b + align - 1) / align * align;
+                }
+                return transfer(n, n->direct, c, d)
+                    && transfer(n, n->file,   a, std::min(c, b))
+                    && transfer(n, n->file,   std::max(d, a), b);
+            }
+        }
+        return transfer(n, n->file, a, b);
+    }
+
+    /// Perform the transfer of band *data*. When writing, skip each aligned
+    /// block of zeros, leaving a hole in the file.
+
+    static void *transfer_main(void *data)
+    {
+        raw_band *n = (raw_band *) data;
+
+        bool ok = true;
+
+        if (n->write)
+        {
+            size_t a = n->a;
+            size_t c;
+
+            while (ok && a < n->b)
+            {
+                for (c = a; c < n->b &&  zero(n->data + c - n->base,
+                                              boundary(c, n->b) - c); )
+                    c = boundary(c, n->b);
+                for (a = c; c < n->b && !zero(n->data + c - n->base,
+                                              boundary(c, n->b) - c); )
+                    c = boundary(c, n->b);
+
+                if (a < c)
+                    ok = transfer(n, a, c);
+
+                a = c;
+            }
+        }
+        else ok = transfer(n, n->a, n->b);
+
+        if (!ok)
+            n->error = errno;
+
+        return 0;
+    }
+
+    /// Return the first alignment boundary after *a*, up to *b*.
+
+    static size_t boundary(size_t a, size_t b)
+    {
+        return std::min(b, (a / align + 1) * align);
+    }
+
+    /// Are all *n* bytes at *p* zero?
+
+    static bool zero(const uint8_t *p, size_t n)
+    {
+        return n == 0 || (p[0] == 0 && memcmp(p, p + 1, n - 1) == 0);
+    }
+
+    /// Punch a hole in the file over each whole page of zeros in the mapping
+    /// between bytes *a* and *b* - 1, freeing its storage.
+
+    void punch(size_t a, size_t b)
+    {
+#ifdef FALLOC_FL_PUNCH_HOLE
+        const size_t page = size_t(sysconf(_SC_PAGESIZE));
+
+        const size_t c = (a + page - 1) / page * page;
+        const size_t d = (b           ) / page * page;
+
+        size_t r = c;
+
+        for (size_t x = c; x < d; x += page)
+            if (!zero(uint8_p(buffer) + x, page))
+            {
+                if (r < x)
+                    fallocate(file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                              r, x - r);
+                r = x + page;
+            }
+
+        if (r < d)
+            fallocate(file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, r, d - r);
+#endif
+    }
 };
 
+char raw::backend = 'm';
+int  raw::pattern = MADV_NORMAL;
+int  raw::tile_size = 256;
+
+size_t raw::cache_size = size_t(256) << 20;
+
+long           raw::serials     = 0;
+pthread_key_t  raw::caches;
+pthread_once_t raw::caches_once = PTHREAD_ONCE_INIT;
+
 //------------------------------------------------------------------------------
 
 // Clamps prevent under and overflow when casting to normalized sample types.
 
 static inline double uclamp(double d)
 {
-    if      (d >  1.0) return  1;
-    else if (d <  0.0) return  0;
-    else               return  d;
+    return std::min(std::max(d,  0.0), 1.0);
 }
 
 static inline double clamp(double d)
 {
-    if      (d >  1.0) return  1;
-    else if (d < -1.0) return -1;
-    else               return  d;
+    return std::min(std::max(d, -1.0), 1.0);
+}
+
+//------------------------------------------------------------------------------
+
+// Converters between single and half precision. F16C instructions are used
+// where the compiler targets them. Otherwise, the conversion is done in
+// software, rounding to nearest even and preserving subnormals, infinities,
+// and NaNs.
+
+static inline uint16_t half(float f)
+{
+#ifdef __F16C__
+    return _cvtss_sh(f, 0);
+#else
+    uint32_t x;
+    float    y;
+
+    memcpy(&x, &f, sizeof (x));
+
+    const uint32_t s = (x >> 16) & 0x8000;
+    const uint32_t a =  x & 0x7FFFFFFF;
+
+    if (a >= 0x47800000)                      // Overflow, infinity, or NaN
+        return s | ((a > 0x7F800000) ? 0x7E00 : 0x7C00);
+
+    if (a <  0x38800000)                      // Subnormal or zero
+    {
+        memcpy(&y, &a, sizeof (y));
+        y += 0.5f;
+        memcpy(&x, &y, sizeof (x));
+        return s | (x - 0x3F000000);
+    }
+    return s | ((a + 0xC8000FFF + ((a >> 13) & 1)) >> 13);
+#endif
+}
+
+static inline float unhalf(uint16_t h)
+{
+#ifdef __F16C__
+    return _cvtsh_ss(h);
+#else
+    const uint32_t s = uint32_t(h & 0x8000) << 16;
+    const uint32_t e = (h >> 10) & 0x1F;
+    const uint32_t m =  h & 0x3FF;
+
+    uint32_t x;
+    float    f;
+
+    if      (e ==  0) return (s ? -5.9604645e-8f : 5.9604645e-8f) * float(m);
+    else if (e == 31) x = s | 0x7F800000      | (m << 13);
+    else              x = s | ((e + 112) << 23) | (m << 13);
+
+    memcpy(&f, &x, sizeof (f));
+    return f;
+#endif
 }
 
 //------------------------------------------------------------------------------
@@ -168,6 +1236,9 @@ static inline void swap(uint8_t *a, uint8_t *b)
     *b = tt;
 }
 
+static inline int8_t  swap(int8_t  n) { return n; }
+static inline uint8_t swap(uint8_t n) { return n; }
+
 static inline int16_t swap(int16_t n)
 {
     swap(uint8_p(&n) + 0, uint8_p(&n) + 1);
@@ -210,269 +1281,211 @@ static inline double swap(double n)
     return n;
 }
 
+static inline float16 swap(float16 n)
+{
+    n.bits = swap(n.bits);
+    return n;
+}
+
 //------------------------------------------------------------------------------
 
-/// Signed 8-bit RAW adapter
+/// Conversion between stored samples of type *T* and normalized doubles.
+/// Integer samples are scaled to the range [0,1] if unsigned or [-1,+1] if
+/// signed, and clamped to that range when stored. Floating point samples are
+/// neither scaled nor clamped.
 
-class rawc : public raw
+template <typename T> struct sample
 {
-public:
-    rawc(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (int8_t), m) { }
-
-    void put(int i, int j, int k, double d)
+    static T encode(double d)
     {
-        *int8_p(data(i, j, k)) = int8_t(clamp(d) * INT8_MAX);
+        return T((std::numeric_limits<T>::is_signed ? clamp(d) : uclamp(d))
+                * std::numeric_limits<T>::max());
     }
-    double get(int i, int j, int k) const
+    static double decode(T t)
     {
-        return double(*int8_p(data(i, j, k))) / INT8_MAX;
+        return double(t) / std::numeric_limits<T>::max();
     }
 };
 
-/// Unsigned 8-bit RAW adapter
-
-class rawb : public raw
+template <> struct sample<float16>
 {
-public:
-    rawb(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (uint8_t), m) { }
-
-    void put(int i, int j, int k, double d)
-    {
-        *uint8_p(data(i, j, k)) = uint8_t(uclamp(d) * UINT8_MAX);
-    }
-    double get(int i, int j, int k) const
-    {
-        return double(*uint8_p(data(i, j, k))) / UINT8_MAX;
-    }
+    static float16 encode(double d) { float16 h = { half(float(d)) }; return h; }
+    static double  decode(float16 h) { return unhalf(h.bits); }
 };
 
-//------------------------------------------------------------------------------
-
-/// Signed 16-bit RAW adapter
-
-class raws : public raw
+template <> struct sample<float>
 {
-public:
-    raws(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (int16_t), m) { }
-
-    void put(int i, int j, int k, double d)
-    {
-        *int16_p(data(i, j, k)) = int16_t(clamp(d) * INT16_MAX);
-    }
-    double get(int i, int j, int k) const
-    {
-        return double(*int16_p(data(i, j, k))) / INT16_MAX;
-    }
+    static float  encode(double d) { return float(d); }
+    static double decode(float  f) { return double(f); }
 };
 
-/// Byte-swapped signed 16-bit RAW adapter
-
-class rawS : public raw
+template <> struct sample<double>
 {
-public:
-    rawS(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (int16_t), m) { }
-
-    void put(int i, int j, int k, double d)
-    {
-        *int16_p(data(i, j, k)) = swap(int16_t(clamp(d) * INT16_MAX));
-    }
-    double get(int i, int j, int k) const
-    {
-        return double(swap(*int16_p(data(i, j, k)))) / INT16_MAX;
-    }
+    static double encode(double d) { return d; }
+    static double decode(double d) { return d; }
 };
 
 //------------------------------------------------------------------------------
 
-/// Unsigned 16-bit RAW adapter
+/// RAW adapter for samples of type *T*, byte-swapped if *S*. Row access is
+/// specialized to the sample type so that decoding, scaling, and clamping may
+/// be inlined and vectorized over each contiguous run of samples.
 
-class rawu : public raw
+template <typename T, bool S> class raw_t : public raw
 {
 public:
-    rawu(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (uint16_t), m) { }
+    raw_t(std::string a, size_t o, size_t h, size_t w, size_t d, bool m, char l)
+        : raw(a, o, h, w, d, sizeof (T), m, l) { }
 
     void put(int i, int j, int k, double d)
     {
-        *uint16_p(data(i, j, k)) = uint16_t(uclamp(d) * UINT16_MAX);
+        *(T *) data(i, j, k) = store(sample<T>::encode(d));
     }
     double get(int i, int j, int k) const
     {
-        return double(*uint16_p(data(i, j, k))) / UINT16_MAX;
+        return sample<T>::decode(store(*(const T *) data(i, j, k)));
     }
-};
-
-/// Byte-swapped unsigned 16-bit RAW adapter
 
-class rawU : public raw
-{
-public:
-    rawU(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (uint16_t), m) { }
-
-    void put(int i, int j, int k, double d)
+    void get_row(int i, int j0, int j1, double *p) const
     {
-        *uint16_p(data(i, j, k)) = swap(uint16_t(uclamp(d) * UINT16_MAX));
+        decode_row(i, j0, j1, p);
     }
-    double get(int i, int j, int k) const
+    void get_row(int i, int j0, int j1, float *p) const
     {
-        return double(swap(*uint16_p(data(i, j, k)))) / UINT16_MAX;
+        decode_row(i, j0, j1, p);
     }
-};
-
-//------------------------------------------------------------------------------
-
-/// Signed 32-bit RAW adapter
-
-class rawi : public raw
-{
-public:
-    rawi(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (int32_t), m) { }
-
-    void put(int i, int j, int k, double d)
+    void put_row(int i, int j0, int j1, const double *p)
     {
-        *int32_p(data(i, j, k)) = int32_t(clamp(d) * INT32_MAX);
+        encode_row(i, j0, j1, p);
     }
-    double get(int i, int j, int k) const
+    void put_row(int i, int j0, int j1, const float *p)
     {
-        return double(*int32_p(data(i, j, k))) / INT32_MAX;
+        encode_row(i, j0, j1, p);
     }
-};
-
-/// Byte-swapped signed 32-bit RAW adapter
 
-class rawI : public raw
-{
-public:
-    rawI(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (int32_t), m) { }
+private:
 
-    void put(int i, int j, int k, double d)
+    static T store(T t)
     {
-        *int32_p(data(i, j, k)) = swap(int32_t(clamp(d) * INT32_MAX));
+        return S ? swap(t) : t;
     }
-    double get(int i, int j, int k) const
-    {
-        return double(swap(*int32_p(data(i, j, k)))) / INT32_MAX;
-    }
-};
-
-//------------------------------------------------------------------------------
-
-/// Unigned 32-bit RAW adapter
 
-class rawl : public raw
-{
-public:
-    rawl(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (uint32_t), m) { }
-
-    void put(int i, int j, int k, double d)
+    template <typename R> void decode_row(int i, int j0, int j1, R *p) const
     {
-        *uint32_p(data(i, j, k)) = uint32_t(uclamp(d) * UINT32_MAX);
+        if (layout == 'l' || layout == 'q')
+            for (int k = 0; k < int(depth); ++k)
+                decode((const T *) data(i, j0, k), p + k, j1 - j0, depth);
+        else
+            for (int j = j0, e; j < j1; j = e)
+            {
+                e = run(j, j1);
+                decode((const T *) data(i, j, 0), p + (j - j0) * depth,
+                                                      (e - j) * depth, 1);
+            }
     }
-    double get(int i, int j, int k) const
+    template <typename R> void encode_row(int i, int j0, int j1, const R *p)
     {
-        return double(*uint32_p(data(i, j, k))) / UINT32_MAX;
+        if (layout == 'l' || layout == 'q')
+            for (int k = 0; k < int(depth); ++k)
+                encode((T *) data(i, j0, k), p + k, j1 - j0, depth);
+        else
+            for (int j = j0, e; j < j1; j = e)
+            {
+                e = run(j, j1);
+                encode((T *) data(i, j, 0), p + (j - j0) * depth,
+                                                (e - j) * depth, 1);
+            }
     }
-};
 
-/// Byte-swapped unsigned 32-bit RAW adapter
+    /// Decode *n* contiguous samples at *s* to every *m*th value at *p*.
 
-class rawL : public raw
-{
-public:
-    rawL(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (uint32_t), m) { }
-
-    void put(int i, int j, int k, double d)
+    template <typename R>
+    static void decode(const T *s, R *p, size_t n, size_t m)
     {
-        *uint32_p(data(i, j, k)) = swap(uint32_t(uclamp(d) * UINT32_MAX));
+        for (size_t x = 0; x < n; ++x)
+            p[x * m] = R(sample<T>::decode(store(s[x])));
     }
-    double get(int i, int j, int k) const
+
+    /// Encode every *m*th of *n* values at *p* to contiguous samples at *s*.
+
+    template <typename R>
+    static void encode(T *s, const R *p, size_t n, size_t m)
     {
-        return double(swap(*uint32_p(data(i, j, k)))) / UINT32_MAX;
+        for (size_t x = 0; x < n; ++x)
+            s[x] = store(sample<T>::encode(p[x * m]));
     }
 };
 
+typedef raw_t< int8_t,   false> rawc;  ///< Signed 8-bit
+typedef raw_t<uint8_t,   false> rawb;  ///< Unsigned 8-bit
+typedef raw_t< int16_t,  false> raws;  ///< Signed 16-bit
+typedef raw_t< int16_t,  true > rawS;  ///< Byte-swapped signed 16-bit
+typedef raw_t<uint16_t,  false> rawu;  ///< Unsigned 16-bit
+typedef raw_t<uint16_t,  true > rawU;  ///< Byte-swapped unsigned 16-bit
+typedef raw_t< int32_t,  false> rawi;  ///< Signed 32-bit
+typedef raw_t< int32_t,  true > rawI;  ///< Byte-swapped signed 32-bit
+typedef raw_t<uint32_t,  false> rawl;  ///< Unsigned 32-bit
+typedef raw_t<uint32_t,  true > rawL;  ///< Byte-swapped unsigned 32-bit
+typedef raw_t<float16,   false> rawh;  ///< Half precision floating point
+typedef raw_t<float16,   true > rawH;  ///< Byte-swapped half precision
+typedef raw_t<float,     false> rawf;  ///< Single precision floating point
+typedef raw_t<float,     true > rawF;  ///< Byte-swapped single precision
+typedef raw_t<double,    false> rawd;  ///< Double precision floating point
+typedef raw_t<double,    true > rawD;  ///< Byte-swapped double precision
+
 //------------------------------------------------------------------------------
 
-/// Single precision floating point RAW adapter
+/// Bit-packed mask RAW adapter. The samples of each row are packed eight to a
+/// byte, most significant bit first, and each row is padded to a whole byte,
+/// as in a bilevel TIFF. Values of one half or more are stored as one. The
+/// file is stored as rows of bytes, so tiles of output no narrower than eight
+/// pixels never share a byte. Only the 'p' layout is supported.
 
-class rawf : public raw
+class rawm : public raw
 {
 public:
-    rawf(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (float), m) { }
-
-    void put(int i, int j, int k, double d)
-    {
-        *float_p(data(i, j, k)) = float(d);
-    }
-    double get(int i, int j, int k) const
+    rawm(std::string a, size_t o, size_t h, size_t w, size_t d, bool m, char l)
+        : raw(a, o, h, (w * d + 7) / 8, 1, sizeof (uint8_t), m, check(a, l))
     {
-        return double(*float_p(data(i, j, k)));
+        columns  = w;
+        channels = d;
+        packed   = true;
     }
-};
-
-/// Byte-swapped single precision floating point RAW adapter
-
-class rawF : public raw
-{
-public:
-    rawF(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (float), m) { }
 
     void put(int i, int j, int k, double d)
     {
-        *float_p(data(i, j, k)) = swap(float(d));
+        const size_t  n = size_t(j) * channels + k;
+        const uint8_t b = uint8_t(0x80 >> (n & 7));
+
+        uint8_t *p = uint8_p(data(i, int(n >> 3), 0));
+
+        if (d >= 0.5)
+            *p |=  b;
+        else
+            *p &= ~b;
     }
     double get(int i, int j, int k) const
     {
-        return double(swap(*float_p(data(i, j, k))));
-    }
-};
-
-//------------------------------------------------------------------------------
-
-/// Single precision floating point RAW adapter
+        const size_t n = size_t(j) * channels + k;
 
-class rawd : public raw
-{
-public:
-    rawd(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (double), m) { }
-
-    void put(int i, int j, int k, double d)
-    {
-        *double_p(data(i, j, k)) = d;
+        return (*(const uint8_t *) data(i, int(n >> 3), 0) & (0x80 >> (n & 7)))
+            ? 1.0 : 0.0;
     }
-    double get(int i, int j, int k) const
+    void copy(int i, int j, int k, const raw& that, int a, int b, int c, int n)
     {
-        return *double_p(data(i, j, k));
+        for (int x = 0; x < n; ++x)
+            put(i, j + x, k, that.get(a, b + x, c));
     }
-};
 
-/// Byte-swapped single precision floating point RAW adapter
+private:
 
-class rawD : public raw
-{
-public:
-    rawD(std::string a, size_t o, size_t h, size_t w, size_t d, bool m)
-        : raw(a, o, h, w, d, sizeof (double), m) { }
+    /// Return layout *l* of mask file *a*, which must be pixel-interleaved.
 
-    void put(int i, int j, int k, double d)
-    {
-        *double_p(data(i, j, k)) = swap(d);
-    }
-    double get(int i, int j, int k) const
+    static char check(const std::string& a, char l)
     {
-        return swap(*double_p(data(i, j, k)));
+        if (l != 'p')
+            throw raw_error(a, "Mask files must have the p layout");
+        return l;
     }
 };
 
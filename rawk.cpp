@@ -9,13 +9,23 @@
 #include <string>
 #include <vector>
 #include <limits>
+#include <numeric>
+#include <fstream>
 
 #include <sys/time.h>
+#include <pthread.h>
 
 #ifdef _OPENMP
 #include <omp.h>
 #else
-int omp_get_thread_num() { return 0; }
+int omp_get_thread_num()  { return 0; }
+int omp_get_max_threads() { return 1; }
+
+typedef int omp_lock_t;
+void omp_init_lock   (omp_lock_t *) { }
+void omp_destroy_lock(omp_lock_t *) { }
+void omp_set_lock    (omp_lock_t *) { }
+void omp_unset_lock  (omp_lock_t *) { }
 #endif
 
 #include "raw.hpp"
@@ -26,10 +36,13 @@ class rawk;
 #include "image_append.hpp"
 #include "image_arithmetic.hpp"
 #include "image_bias.hpp"
+#include "image_bilateral.hpp"
 #include "image_blend.hpp"
 #include "image_choose.hpp"
+#include "image_clahe.hpp"
 #include "image_convolve.hpp"
 #include "image_crop.hpp"
+#include "image_distance.hpp"
 #include "image_function.hpp"
 #include "image_gain.hpp"
 #include "image_input.hpp"
@@ -39,9 +52,11 @@ class rawk;
 #include "image_offset.hpp"
 #include "image_output.hpp"
 #include "image_paste.hpp"
+#include "image_pca.hpp"
 #include "image_reduce.hpp"
 #include "image_resample.hpp"
 #include "image_sobel.hpp"
+#include "image_stats.hpp"
 #include "image_solid.hpp"
 #include "image_swizzle.hpp"
 #include "image_threshold.hpp"
@@ -102,6 +117,36 @@ int parse_int(int& i, char **v)
     throw parse_error(v[i], "an integer value");
 }
 
+std::vector<double> parse_matrix(int& i, char **v, int n)
+{
+    std::vector<double> d;
+
+    if (v[i])
+    {
+        char *e;
+        strtod(v[i], &e);
+
+        if (e[0] == 0)
+            for (int k = 0; k < n; k++)
+                d.push_back(parse_double(i, v));
+        else
+        {
+            std::ifstream file(v[i]);
+            double x;
+
+            while (int(d.size()) < n && file >> x)
+                d.push_back(x);
+
+            if (int(d.size()) == n)
+                i++;
+        }
+    }
+    if (int(d.size()) == n)
+        return d;
+
+    throw parse_error(v[i], "matrix values or a file of them");
+}
+
 int parse_wrap(int& i, char **v)
 {
     if (v[i])
@@ -134,12 +179,33 @@ char parse_type(int& i, char **v)
                 case 's': case 'S':
                 case 'l': case 'L':
                 case 'i': case 'I':
+                case 'h': case 'H':
                 case 'f': case 'F':
-                case 'd': case 'D': return v[i++][0];
+                case 'd': case 'D':
+                case 'm': return v[i++][0];
             }
         }
     }
-    throw parse_error(v[i], "a data type token (ucuslifdUSLIFD)");
+    throw parse_error(v[i], "a data type token (bcuslihfdmUSLIHFD)");
+}
+
+char parse_layout(int& i, char **v)
+{
+    if (v[i])
+    {
+        if (v[i][0] && !v[i][1])
+        {
+            switch (v[i][0])
+            {
+                case 'p':
+                case 'l':
+                case 'q':
+                case 't':
+                case 'z': return v[i++][0];
+            }
+        }
+    }
+    return 'p';
 }
 
 image *parse_image(int& i, char **v)
@@ -161,6 +227,15 @@ image *parse_image(int& i, char **v)
             return new append(L, R);
         }
 
+        if (op == "autolevel")
+        {
+            double l = parse_double(i, v);
+            double h = parse_double(i, v);
+            int    s = parse_int   (i, v);
+            image *L = parse_image (i, v);
+            return new autolevel(l, h, s, L);
+        }
+
         if (op == "bias")
         {
             double d = parse_double(i, v);
@@ -168,6 +243,14 @@ image *parse_image(int& i, char **v)
             return new bias(d, L);
         }
 
+        if (op == "bilateral")
+        {
+            double s = parse_double(i, v);
+            double r = parse_double(i, v);
+            image *L = parse_image (i, v);
+            return new bilateral(s, r, L);
+        }
+
         if (op == "blend")
         {
             image *L = parse_image(i, v);
@@ -183,6 +266,14 @@ image *parse_image(int& i, char **v)
             return new choose(n, L, R);
         }
 
+        if (op == "clahe")
+        {
+            int    t = parse_int   (i, v);
+            double c = parse_double(i, v);
+            image *L = parse_image (i, v);
+            return new clahe(t, c, L);
+        }
+
         if (op == "crop")
         {
             int    r = parse_int(i, v);
@@ -217,6 +308,13 @@ image *parse_image(int& i, char **v)
             return new dilate(r, m, L);
         }
 
+        if (op == "distance")
+        {
+            int    m = parse_wrap(i, v);
+            image *L = parse_image(i, v);
+            return new distance(m, L);
+        }
+
         if (op == "erode")
         {
             int    r = parse_int(i, v);
@@ -271,7 +369,8 @@ image *parse_image(int& i, char **v)
             int    w = parse_int(i, v);
             int    d = parse_int(i, v);
             char   t = parse_type(i, v);
-            return new input(a, o, h, w, d, t);
+            char   l = parse_layout(i, v);
+            return new input(a, o, h, w, d, t, l);
         }
 
         if (op == "linear")
@@ -283,6 +382,15 @@ image *parse_image(int& i, char **v)
             return new linear(h, w, m, L);
         }
 
+        if (op == "matrix")
+        {
+            int    r = parse_int(i, v);
+            int    c = parse_int(i, v);
+            std::vector<double> d = parse_matrix(i, v, r * c);
+            image *L = parse_image(i, v);
+            return new matrix(r, c, d, L);
+        }
+
         if (op == "median")
         {
             int    r = parse_int(i, v);
@@ -334,9 +442,10 @@ image *parse_image(int& i, char **v)
         if (op == "output")
         {
             char  *a = parse_string(i, v);
-            char   t = parse_type (i, v);
-            image *L = parse_image(i, v);
-            return new output(a, t, L);
+            char   t = parse_type  (i, v);
+            char   l = parse_layout(i, v);
+            image *L = parse_image (i, v);
+            return new output(a, t, l, L);
         }
 
         if (op == "paste")
@@ -348,6 +457,13 @@ image *parse_image(int& i, char **v)
             return new paste(r, c, L, R);
         }
 
+        if (op == "pca")
+        {
+            int    n = parse_int(i, v);
+            image *L = parse_image(i, v);
+            return new pca(n, L);
+        }
+
         if (op == "reduce")
         {
             image *L = parse_image(i, v);
@@ -391,6 +507,14 @@ image *parse_image(int& i, char **v)
             return new solid(h, w, d);
         }
 
+        if (op == "stats")
+        {
+            std::string n = parse_string(i, v);
+            int         s = parse_int   (i, v);
+            image      *L = parse_image (i, v);
+            return new stats(n, s, L);
+        }
+
         if (op == "sum")
         {
             image *L = parse_image(i, v);
@@ -448,36 +572,39 @@ struct state
     }
 };
 
-/// RAWK application
+/// Size in pixels of the preview tiles over which costs are accounted. This
+/// must match the heat map shader.
 
-class rawk : public gl::demonstration
+static const int tile_size = 16;
+
+/// Return the number of preview tiles spanning *n* pixels.
+
+static inline int tiles(int n)
 {
-public:
-    rawk(image *, int, int, double, double, double);
-   ~rawk();
+    return (n + tile_size - 1) / tile_size;
+}
 
-    void   draw();
-    void  wheel(int, int);
-    void motion(int, int);
-    void button(int, bool);
-    void    key(int, bool, bool);
+//------------------------------------------------------------------------------
 
-private:
+/// Preview view and interaction, independent of any display
 
-    // OpenGL state
+class view
+{
+public:
+    view(image *, int, int, double, double, double);
+    virtual ~view();
 
-    void init_vbuffer();
-    void init_program(std::string, std::string);
-    void init_texture();
+    void init();
 
-    GLuint varray;                 ///< GL vertex array object
-    GLuint vbuffer;                ///< GL vertex buffer object
-    GLuint program;                ///< GL program object
-    GLuint texture;                ///< GL texture object
+    virtual void  wheel(int, int);
+    virtual void motion(int, int);
+    virtual void button(int, bool);
+    virtual void    key(int, bool, bool);
 
-    GLint  u_offset;               ///< Offset uniform location
-    GLint  u_scale;                ///< Scale uniform location
-    GLint  u_zoom;                 ///< Zoom uniform location
+protected:
+
+    int    width;                  ///< Width of the view in pixels
+    int    height;                 ///< Height of the view in pixels
 
     // Interaction state
 
@@ -501,6 +628,26 @@ private:
     image               *mark_image[12];
     std::vector<GLfloat> mark_cache[12];
 
+    image               *tweak_image;
+    image               *view_image;
+
+    void   tweak(image *, int, int);
+
+    // Idle-time prefetch of neighboring views
+
+    pthread_t            prefetch_thread;
+    bool                 prefetch_running; ///< Prefetch thread started?
+    volatile bool        prefetch_cancel;  ///< Prefetch cancellation request
+    state                prefetch_state;   ///< View around which to prefetch
+    bool                 prefetch_wide;    ///< Cache covers prefetched views?
+
+    static void *prefetch_main(void *);
+
+    void  start_prefetch();
+    void cancel_prefetch();
+    void       prefetch();
+    void       prefetch(double, int, int, int, int);
+
     image *doL(image *);
     image *doR(image *);
     image *doU(image *);
@@ -511,28 +658,79 @@ private:
     void   doU();
     void   doD();
 
-    void refresh();
-    void retitle();
-
-    void cache_row(image *, state *, int, int);
+    virtual void refresh();
 
     void zerocache(int selector=-1);
-    void showcache(int selector=-1);
+
+    // Cost accounting
+
+    bool                 profiling;        ///< Accounting for costs?
+    std::vector<GLfloat> curr_heat;        ///< Normalized cost of each tile
+
+    void instrument(bool);
+    void top(std::ostream&, int);
+
+    // Display hooks
+
+    virtual void showcache(int selector=-1) { }
+    virtual void shade(std::string)         { }
 };
 
 //------------------------------------------------------------------------------
 
-rawk::rawk(image *p, int h, int w, double x, double y, double z)
-    : demonstration("RAWK", w, h), program(0), curr_cache(width * height * 3)
+/// RAWK application
+
+class rawk : public gl::demonstration, public view
 {
-    // Initialize the OpenGL state.
+public:
+    rawk(image *, int, int, double, double, double, const char *);
+   ~rawk();
 
-    glClearColor(0.1f, 0.1f, 0.1f, 0.0f);
+    void   draw();
+    void  wheel(int, int);
+    void motion(int, int);
+    void button(int, bool);
+    void    key(int, bool, bool);
 
-    init_vbuffer();
-    init_program("rawk.vert", "rawk_rgb.frag");
-    init_texture();
+private:
+
+    using view::width;
+    using view::height;
 
+    // OpenGL state
+
+    void init_vbuffer();
+    void init_program(std::string, std::string);
+    void init_texture();
+
+    GLuint varray;                 ///< GL vertex array object
+    GLuint vbuffer;                ///< GL vertex buffer object
+    GLuint program;                ///< GL program object
+    GLuint texture;                ///< GL texture object
+    GLuint heatmap;                ///< GL cost texture object
+
+    GLint  u_offset;               ///< Offset uniform location
+    GLint  u_scale;                ///< Scale uniform location
+    GLint  u_zoom;                 ///< Zoom uniform location
+
+    // Session recording
+
+    std::ofstream  record_file;    ///< Event log, if recording
+    struct timeval record_time;    ///< Time at which recording began
+
+    void record(const char *, int, int, int);
+
+    void retitle();
+    void showcache(int selector=-1);
+    void shade(std::string);
+};
+
+//------------------------------------------------------------------------------
+
+view::view(image *p, int h, int w, double x, double y, double z)
+    : width(w), height(h), curr_cache(w * h * 3),
+      curr_heat(tiles(w) * tiles(h))
+{
     // Initialize the application state.
 
     dragging =  false;
@@ -542,14 +740,35 @@ rawk::rawk(image *p, int h, int w, double x, double y, double z)
 
     // Initialize the cached and marked view states and images.
 
-    curr_image = p;
+    root_image  = p;
+    curr_image  = p;
+    tweak_image = 0;
+    view_image  = 0;
+
+    prefetch_running = false;
+    prefetch_cancel  = false;
+    prefetch_wide    = false;
+    profiling        = false;
 
     curr_state.center(curr_image, width, height);
 
     if (x) curr_state.x = x;
     if (y) curr_state.y = y;
     if (z) curr_state.z = z;
+}
+
+view::~view()
+{
+    cancel_prefetch();
+
+    delete root_image;
+}
 
+/// Compute the initial view and store it in all marks. This must follow the
+/// initialization of the display, if any.
+
+void view::init()
+{
     refresh();
 
     for (int i = 0; i < 12; i++)
@@ -560,14 +779,45 @@ rawk::rawk(image *p, int h, int w, double x, double y, double z)
     }
 }
 
-rawk::~rawk()
+//------------------------------------------------------------------------------
+
+rawk::rawk(image *p, int h, int w, double x, double y, double z, const char *r)
+    : demonstration("RAWK", w, h), view(p, h, w, x, y, z), program(0)
 {
-    delete root_image;
+    // Initialize the OpenGL state.
+
+    glClearColor(0.1f, 0.1f, 0.1f, 0.0f);
+
+    init_vbuffer();
+    init_program("rawk.vert", "rawk_rgb.frag");
+    init_texture();
+
+    // Begin recording the session, noting the initial view.
+
+    if (r)
+    {
+        record_file.open(r);
+
+        if (!record_file)
+            throw std::runtime_error(std::string(r) + ": " + strerror(errno));
+
+        record_file << std::setprecision(17) << "rawk "
+                    << height << " " << width << " " << curr_state.x << " "
+                    << curr_state.y << " " << curr_state.z << std::endl;
+
+        gettimeofday(&record_time, 0);
+    }
+
+    view::init();
+}
 
+rawk::~rawk()
+{
     glDeleteProgram(program);
 
     glDeleteBuffers     (1, &vbuffer);
     glDeleteTextures    (1, &texture);
+    glDeleteTextures    (1, &heatmap);
     glDeleteVertexArrays(1, &varray);
 }
 
@@ -631,13 +881,29 @@ void rawk::init_program(std::string vert, std::string frag)
         u_offset  = glGetUniformLocation(program, "offset");
         u_scale   = glGetUniformLocation(program, "scale");
         u_zoom    = glGetUniformLocation(program, "zoom");
+
+        // Bind the image and cost textures to their units.
+
+        glUniform1i(glGetUniformLocation(program, "Image"), 0);
+        glUniform1i(glGetUniformLocation(program, "Cost"),  1);
     }
 }
 
-/// Initialize a texture object for use as image cache.
+/// Initialize texture objects for use as image cache and cost heat map.
 
 void rawk::init_texture()
 {
+    glActiveTexture(GL_TEXTURE1);
+    glGenTextures(1, &heatmap);
+
+    glBindTexture  (GL_TEXTURE_2D, heatmap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, tiles(width), tiles(height), 0,
+                                   GL_RED, GL_FLOAT, 0);
+
+    glActiveTexture(GL_TEXTURE0);
     glGenTextures(1, &texture);
 
     glBindTexture  (GL_TEXTURE_2D, texture);
@@ -650,14 +916,34 @@ void rawk::init_texture()
 
 //------------------------------------------------------------------------------
 
+/// Tweak parameter *a* of image *p* by *v*. The subtrees below *p* are cached
+/// so that subsequent refreshes recompute only the path from *p* to the root.
+
+void view::tweak(image *p, int a, int v)
+{
+    cancel_prefetch();
+
+    if (p != tweak_image)
+    {
+        root_image->uncache();
+
+        if (p->getL()) p->getL()->cache(true);
+        if (p->getR()) p->getR()->cache(true);
+
+        tweak_image = p;
+    }
+    p->tweak(a, v);
+    p->touch();
+}
+
 /// Traverse the node hierarchy or tweak an image parameter left.
 
-image *rawk::doL(image *p)
+image *view::doL(image *p)
 {
     const SDL_Keymod mod = SDL_GetModState();
 
-    if      (mod == KMOD_NONE)  p->tweak(0, -1);
-    else if (mod &  KMOD_SHIFT) p->tweak(0, -10);
+    if      (mod == KMOD_NONE)  tweak(p, 0, -1);
+    else if (mod &  KMOD_SHIFT) tweak(p, 0, -10);
     else if (mod &  KMOD_GUI && p->getL()) p = p->getL();
 
     return p;
@@ -665,12 +951,12 @@ image *rawk::doL(image *p)
 
 /// Traverse the node hierarchy or tweak an image parameter right.
 
-image *rawk::doR(image *p)
+image *view::doR(image *p)
 {
     const SDL_Keymod mod = SDL_GetModState();
 
-    if      (mod == KMOD_NONE)  p->tweak(0, +1);
-    else if (mod &  KMOD_SHIFT) p->tweak(0, +10);
+    if      (mod == KMOD_NONE)  tweak(p, 0, +1);
+    else if (mod &  KMOD_SHIFT) tweak(p, 0, +10);
     else if (mod &  KMOD_GUI && p->getR()) p = p->getR();
 
     return p;
@@ -678,12 +964,12 @@ image *rawk::doR(image *p)
 
 /// Traverse the node hierarchy or tweak an image parameter up.
 
-image *rawk::doU(image *p)
+image *view::doU(image *p)
 {
     const SDL_Keymod mod = SDL_GetModState();
 
-    if      (mod == KMOD_NONE)  p->tweak(1, -1);
-    else if (mod &  KMOD_SHIFT) p->tweak(1, -10);
+    if      (mod == KMOD_NONE)  tweak(p, 1, -1);
+    else if (mod &  KMOD_SHIFT) tweak(p, 1, -10);
     else if (mod &  KMOD_GUI && p->getP()) p = p->getP();
 
     return p;
@@ -691,12 +977,12 @@ image *rawk::doU(image *p)
 
 /// Traverse the node hierarchy or tweak an image parameter down.
 
-image *rawk::doD(image *p)
+image *view::doD(image *p)
 {
     const SDL_Keymod mod = SDL_GetModState();
 
-    if      (mod == KMOD_NONE)  p->tweak(1, +1);
-    else if (mod &  KMOD_SHIFT) p->tweak(1, +10);
+    if      (mod == KMOD_NONE)  tweak(p, 1, +1);
+    else if (mod &  KMOD_SHIFT) tweak(p, 1, +10);
 
     return p;
 }
@@ -705,7 +991,7 @@ image *rawk::doD(image *p)
 
 /// Apply left arrow key press to a current or marked image node.
 
-void rawk::doL()
+void view::doL()
 {
     if (selector < 0)
         curr_image = doL(curr_image);
@@ -715,7 +1001,7 @@ void rawk::doL()
 
 /// Apply right arrow key press to a current or marked image node.
 
-void rawk::doR()
+void view::doR()
 {
     if (selector < 0)
         curr_image = doR(curr_image);
@@ -725,7 +1011,7 @@ void rawk::doR()
 
 /// Apply up arrow key press to a current or marked image node.
 
-void rawk::doU()
+void view::doU()
 {
     if (selector < 0)
         curr_image = doU(curr_image);
@@ -735,7 +1021,7 @@ void rawk::doU()
 
 /// Apply down arrow key press to a current or marked image node.
 
-void rawk::doD()
+void view::doD()
 {
     if (selector < 0)
         curr_image = doD(curr_image);
@@ -747,8 +1033,10 @@ void rawk::doD()
 
 /// Handle mouse pointer motion.
 
-void rawk::motion(int x, int y)
+void view::motion(int x, int y)
 {
+    if (dragging) cancel_prefetch();
+
     point_x = x;
     point_y = y;
 
@@ -761,8 +1049,10 @@ void rawk::motion(int x, int y)
 
 /// Handle mouse button press and release.
 
-void rawk::button(int button, bool down)
+void view::button(int button, bool down)
 {
+    cancel_prefetch();
+
     if (button == SDL_BUTTON_LEFT)
     {
         dragging    = down;
@@ -774,8 +1064,10 @@ void rawk::button(int button, bool down)
 
 /// Handle mouse wheel rotation.
 
-void rawk::wheel(int dx, int dy)
+void view::wheel(int dx, int dy)
 {
+    cancel_prefetch();
+
     // Compute pointer position relativate to the center of the screen.
 
     double xx = point_x - 0.5 * width;
@@ -798,8 +1090,10 @@ void rawk::wheel(int dx, int dy)
 
 /// Handle a key press or release event.
 
-void rawk::key(int key, bool down, bool repeat)
+void view::key(int key, bool down, bool repeat)
 {
+    cancel_prefetch();
+
     if (repeat == false)
     {
         if (down)
@@ -808,22 +1102,32 @@ void rawk::key(int key, bool down, bool repeat)
                 switch (key)
                 {
                     case SDL_SCANCODE_GRAVE:
-                        init_program("rawk.vert", "rawk_rgb.frag");
+                        instrument(false);
+                        shade("rawk_rgb.frag");
                         break;
                     case SDL_SCANCODE_1:
-                        init_program("rawk.vert", "rawk_1.frag");
+                        instrument(false);
+                        shade("rawk_1.frag");
                         break;
                     case SDL_SCANCODE_2:
-                        init_program("rawk.vert", "rawk_2.frag");
+                        instrument(false);
+                        shade("rawk_2.frag");
                         break;
                     case SDL_SCANCODE_3:
-                        init_program("rawk.vert", "rawk_3.frag");
+                        instrument(false);
+                        shade("rawk_3.frag");
                         break;
                     case SDL_SCANCODE_4:
-                        init_program("rawk.vert", "rawk_luma.frag");
+                        instrument(false);
+                        shade("rawk_luma.frag");
                         break;
                     case SDL_SCANCODE_5:
-                        init_program("rawk.vert", "rawk_color.frag");
+                        instrument(false);
+                        shade("rawk_color.frag");
+                        break;
+                    case SDL_SCANCODE_6:
+                        instrument(true);
+                        shade("rawk_heat.frag");
                         break;
                 }
             else
@@ -948,43 +1252,155 @@ void rawk::retitle()
     for (int k = 0; k < p->get_depth(); k++)
         stream << (k ? "/" : "") << p->get(i, j, k);
 
+    // Include the most costly images of the last refresh.
+
+    if (profiling)
+        top(stream, 3);
+
     // Update the window title.
 
     SDL_SetWindowTitle(window, stream.str().c_str());
 }
 
-void rawk::cache_row(image *p, state *s, int r, int d)
+/// Compute the image positions sampled along one axis by a preview grid of the
+/// given *size* centered on *x* at zoom *z*. If *wide*, extend it to cover the
+/// neighboring views precomputed by view::prefetch.
+
+static std::vector<int> lattice(double x, double z, int size, bool wide)
 {
+    std::vector<int> v;
+
+    if (wide)
+    {
+        for (int m = -size;     m < size;            ++m)
+            v.push_back(toint(x + m * z));
+        for (int m = -size / 2; m < size - size / 2; ++m)
+            v.push_back(toint(x + m * (z * 0.5)));
+    }
+    else
+        for (int m = -size / 2; m < size - size / 2; ++m)
+            v.push_back(toint(x + m * z));
+
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+    return v;
+}
+
+/// Sample row *r* of the first *d* channels of image *p* as seen from view
+/// state *s* into an RGB *cache* of the given *width* and *height*. Note the
+/// tile of each sample for the sake of cost accounting.
+
+static void cache_row(image *p, const state *s, GLfloat *cache,
+                      int width, int height, int r, int d)
+{
+    // Compute whole pixels unless that would compute unseen channels.
+
+    const bool whole = (p->get_depth() <= d);
+
+    std::vector<real> v(std::max(p->get_depth(), d));
+
     for (int c = 0; c < width; ++c)
     {
         int i = toint(s->y + (r - height / 2) * s->z);
         int j = toint(s->x + (c - width  / 2) * s->z);
 
+        image::tile = (r / tile_size) * tiles(width) + c / tile_size;
+
+        if (whole)
+            p->get_pixel(i, j, &v.front());
+        else
+            for (int k = 0; k < d; ++k)
+                v[k] = p->get(i, j, k);
+
         for (int k = 0; k < d; ++k)
-            curr_cache[(r * width + c) * 3 + k] = p->get(i, j, k);
+            cache[(r * width + c) * 3 + k] = v[k];
+    }
+    image::tile = -1;
+}
+
+/// Gather image *p* and all of its instrumented descendants into *v*.
+
+static void collect(image *p, std::vector<image *>& v)
+{
+    if (p && p->get_profile())
+    {
+        v.push_back(p);
+        collect(p->getL(), v);
+        collect(p->getR(), v);
     }
 }
 
+/// Order images by decreasing total cost.
+
+static bool costlier(image *a, image *b)
+{
+    return a->get_profile()->total_time() > b->get_profile()->total_time();
+}
+
 /// Update the contents of the image cache.
 
-void rawk::refresh()
+void view::refresh()
 {
     if (curr_image)
     {
+        cancel_prefetch();
+
         temp_state = curr_state;
 
+        // Make any whole-image passes before sampling begins, so that they
+        // run in parallel rather than within a sampling thread.
+
+        root_image->prepare();
+
         struct timeval tv;
         gettimeofday(&tv, 0);
 
         int r, d = std::min(curr_image->get_depth(), 3);
 
+        // Cache the current image, retaining any samples already prefetched,
+        // and bring cached subtrees up to date with the view and the tree.
+
+        if (view_image != curr_image)
+        {
+            if (view_image && view_image->getP() != tweak_image)
+                view_image->cache(false);
+
+            view_image = curr_image;
+        }
+        curr_image->cache(true);
+
+        // Cover the neighboring views as well, unless the current image would
+        // then exceed the cache limit, in which case cover only this view and
+        // let the prefetch merely advise.
+
+        const double x = curr_state.x;
+        const double y = curr_state.y;
+        const double z = curr_state.z;
+
+        std::vector<int> rows    = lattice(y, z, height, true);
+        std::vector<int> columns = lattice(x, z, width,  true);
+
+        prefetch_wide = (rows.size() * columns.size()
+                       * curr_image->get_depth() <= memo::limit);
+
+        if (!prefetch_wide)
+        {
+            rows    = lattice(y, z, height, false);
+            columns = lattice(x, z, width,  false);
+        }
+        root_image->recache(rows, columns);
+
+        if (profiling)
+            root_image->instrument(tiles(width) * tiles(height));
+
         zerocache();
         showcache();
 
         #pragma omp parallel for schedule(dynamic)
         for (r = 0; r < height; ++r)
         {
-            cache_row(curr_image, &curr_state, r, d);
+            cache_row(curr_image, &curr_state, &curr_cache.front(),
+                      width, height, r, d);
 
             if (omp_get_thread_num() == 0)
             {
@@ -995,10 +1411,205 @@ void rawk::refresh()
                 }
             }
         }
+
+        // Total the costs of all images in each tile and normalize them.
+
+        if (profiling)
+        {
+            std::vector<image *> v;
+            collect(curr_image, v);
+
+            std::fill(curr_heat.begin(), curr_heat.end(), 0.0f);
+
+            for     (size_t n = 0; n < v.size(); ++n)
+                for (size_t t = 0; t < curr_heat.size(); ++t)
+                    curr_heat[t] += v[n]->get_profile()->time[t];
+
+            if (double m = *std::max_element(curr_heat.begin(), curr_heat.end()))
+                for (size_t t = 0; t < curr_heat.size(); ++t)
+                    curr_heat[t] /= m;
+        }
+
         showcache();
+        start_prefetch();
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/// Enable or disable cost accounting. While enabled, each refresh charges the
+/// time spent by each image to the preview tile being sampled.
+
+void view::instrument(bool b)
+{
+    if (!b) root_image->instrument(0);
+    profiling = b;
+}
+
+/// Write the *n* images with the greatest cost in the last refresh.
+
+void view::top(std::ostream& out, int n)
+{
+    std::vector<image *> v;
+    collect(curr_image, v);
+
+    std::sort(v.begin(), v.end(), costlier);
+
+    double t = 0;
+
+    for (size_t i = 0; i < v.size(); ++i)
+        t += v[i]->get_profile()->total_time();
+
+    out << std::fixed << std::setprecision(0);
+
+    for (size_t i = 0; i < v.size() && int(i) < n && t > 0; ++i)
+    {
+        out << (i ? ", " : " [");
+        v[i]->doc(out);
+        out << " " << 100.0 * v[i]->get_profile()->total_time() / t << "% "
+            << v[i]->get_profile()->total_calls() << "x";
+    }
+    if (t > 0) out << "]";
+}
+
+//------------------------------------------------------------------------------
+
+/// Begin precomputing the views around the current view in the background.
+
+void view::start_prefetch()
+{
+    prefetch_state  = curr_state;
+    prefetch_cancel = false;
+
+    if (pthread_create(&prefetch_thread, 0, prefetch_main, this) == 0)
+        prefetch_running = true;
+}
+
+/// Stop any background prefetch and wait for it to finish. This must precede
+/// any change to the view or the image tree.
+
+void view::cancel_prefetch()
+{
+    if (prefetch_running)
+    {
+        prefetch_cancel = true;
+        pthread_join(prefetch_thread, 0);
+        prefetch_running = false;
     }
 }
 
+void *view::prefetch_main(void *data)
+{
+    ((view *) data)->prefetch();
+    return 0;
+}
+
+/// Precompute the samples of the views neighboring the prefetch view: the views
+/// at double and half its zoom, and the eight half-view pans surrounding it.
+/// Samples land in the cache of the current image, whose grid covers them all
+/// unless that would exceed the cache limit.
+
+void view::prefetch()
+{
+    const double z = prefetch_state.z;
+
+    const int h[4] = { -height, -height / 2, height - height / 2, height };
+    const int w[4] = { -width,  -width  / 2, width  - width  / 2, width  };
+
+    prefetch(z * 2.0, h[1], h[2], w[1], w[2]);
+    prefetch(z * 0.5, h[1], h[2], w[1], w[2]);
+
+    for     (int a = 0; a < 3; ++a)
+        for (int b = 0; b < 3; ++b)
+            if (a != 1 || b != 1)
+                prefetch(z, h[a], h[a + 1], w[b], w[b + 1]);
+}
+
+/// Advise the sources of, and then sample, one tile of the preview grid at zoom
+/// *z*, spanning grid rows *m0* through *m1* - 1 and columns *n0* through *n1*
+/// - 1 relative to the center of the prefetch view.
+
+void view::prefetch(double z, int m0, int m1, int n0, int n1)
+{
+    const state *s = &prefetch_state;
+
+    const int d  = std::min(curr_image->get_depth(), 3);
+    const int j0 = toint(s->x + n0 * z);
+    const int j1 = toint(s->x + (n1 - 1) * z) + 1;
+
+    int m;
+
+    for (m = m0; m < m1 && !prefetch_cancel; ++m)
+    {
+        const int i = toint(s->y + m * z);
+        curr_image->advise(i, j0, i + 1, j1);
+    }
+
+    // Samples falling outside the cache would be discarded.
+
+    if (!prefetch_wide)
+        return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (m = m0; m < m1; ++m)
+        if (!prefetch_cancel)
+        {
+            const int i = toint(s->y + m * z);
+
+            std::vector<real> v(curr_image->get_depth());
+
+            for (int n = n0; n < n1; ++n)
+                if (curr_image->get_depth() <= d)
+                    curr_image->get_pixel(i, toint(s->x + n * z), &v.front());
+                else
+                    for (int k = 0; k < d; ++k)
+                        curr_image->get(i, toint(s->x + n * z), k);
+        }
+}
+
+/// Log an event of the given *type* with arguments *a*, *b*, and *c*, along
+/// with the time since recording began and the current key modifier state.
+
+void rawk::record(const char *type, int a, int b, int c)
+{
+    if (record_file.is_open())
+        record_file << std::fixed << std::setprecision(6)
+                    << getsecsince(&record_time) << " " << type << " "
+                    << a << " " << b << " " << c << " "
+                    << int(SDL_GetModState()) << std::endl;
+}
+
+void rawk::wheel(int dx, int dy)
+{
+    record("wheel", dx, dy, 0);
+    view::wheel(dx, dy);
+}
+
+void rawk::motion(int x, int y)
+{
+    record("motion", x, y, 0);
+    view::motion(x, y);
+}
+
+void rawk::button(int b, bool d)
+{
+    record("button", b, d, 0);
+    view::button(b, d);
+}
+
+void rawk::key(int k, bool d, bool r)
+{
+    record("key", k, d, r);
+    view::key(k, d, r);
+}
+
+/// Switch to the display mode implemented by fragment shader *frag*.
+
+void rawk::shade(std::string frag)
+{
+    init_program("rawk.vert", frag);
+}
+
 /// Render the contents of the image cache to the screen.
 
 void rawk::draw()
@@ -1018,7 +1629,7 @@ void rawk::draw()
     retitle();
 }
 
-void rawk::zerocache(int selector)
+void view::zerocache(int selector)
 {
     if (selector < 0)
         std::fill(curr_cache.begin(),
@@ -1030,6 +1641,13 @@ void rawk::zerocache(int selector)
 
 void rawk::showcache(int selector)
 {
+    if (profiling)
+    {
+        glActiveTexture(GL_TEXTURE1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tiles(width), tiles(height),
+                        GL_RED, GL_FLOAT, &curr_heat.front());
+        glActiveTexture(GL_TEXTURE0);
+    }
     if (selector < 0)
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
                         GL_RGB, GL_FLOAT, &curr_cache.front());
@@ -1042,11 +1660,200 @@ void rawk::showcache(int selector)
 
 //------------------------------------------------------------------------------
 
+/// Headless session replay
+
+class replay : public view
+{
+public:
+    /// Replay a session recorded by rawk, with a view of the given *height* and
+    /// *width* initially centered on *x*, *y* at zoom *z*.
+
+    replay(image *p, int height, int width, double x, double y, double z)
+        : view(p, height, width, x, y, z) { }
+
+    void play(std::istream&);
+    void report(std::ostream&);
+
+private:
+    std::vector<double> latency;   ///< Duration of each refresh
+
+    void refresh();
+};
+
+/// Feed each recorded event to the view's handlers at the time it originally
+/// occurred, restoring the key modifier state in effect at the time.
+
+void replay::play(std::istream& in)
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+
+    std::string type;
+    double t;
+    int    a, b, c, m;
+
+    while (in >> t >> type >> a >> b >> c >> m)
+    {
+        double dt = t - getsecsince(&tv);
+
+        if (dt > 0)
+            usleep(useconds_t(dt * 1000000.0));
+
+        SDL_SetModState(SDL_Keymod(m));
+
+        if      (type == "wheel")   wheel(a, b);
+        else if (type == "motion") motion(a, b);
+        else if (type == "button") button(a, b);
+        else if (type == "key")       key(a, b, c);
+        else throw std::runtime_error("Unknown event type '" + type + "'");
+    }
+}
+
+void replay::refresh()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+
+    view::refresh();
+
+    latency.push_back(getsecsince(&tv));
+}
+
+/// Report the latency percentiles of all refreshes. If the session enabled the
+/// heat map, include the most costly images of the last refresh.
+
+void replay::report(std::ostream& out)
+{
+    std::vector<double> v(latency);
+
+    std::sort(v.begin(), v.end());
+
+    out << v.size() << " refreshes";
+
+    if (!v.empty())
+    {
+        const double p[] = { 0.5, 0.9, 0.99, 1.0 };
+        const char  *n[] = { "p50", "p90", "p99", "max" };
+
+        out << std::fixed << std::setprecision(3) << ", mean "
+            << std::accumulate(v.begin(), v.end(), 0.0) / v.size() << " s";
+
+        for (int i = 0; i < 4; ++i)
+            out << ", " << n[i] << " "
+                << v[std::min(size_t(p[i] * v.size()), v.size() - 1)] << " s";
+    }
+    if (profiling)
+        top(out, 3);
+
+    out << std::endl;
+}
+
+/// Replay the session recorded in file *name* using image *p*.
+
+void play(image *p, const char *name)
+{
+    std::ifstream in(name);
+    std::string   tag;
+
+    int    h, w;
+    double x, y, z;
+
+    if (!(in >> tag >> h >> w >> x >> y >> z) || tag != "rawk")
+        throw std::runtime_error(std::string(name) + ": not a recorded session");
+
+    replay app(p, h, w, x, y, z);
+
+    app.init();
+    app.play(in);
+    app.report(std::cout);
+}
+
+//------------------------------------------------------------------------------
+
+/// Render image *p* exactly as the preview would, but without opening a window.
+/// The view is given by *h*, *w*, *x*, *y*, and *z* as on the command line.
+/// Write the resulting RGB cache to the single precision raw file *name* and
+/// report the wall time, sample throughput, and per-thread balance.
+
+void bench(image *p, const char *name, int h, int w, double x, double y, double z)
+{
+    state s;
+
+    s.center(p, w, h);
+
+    if (x) s.x = x;
+    if (y) s.y = y;
+    if (z) s.z = z;
+
+    const int n = omp_get_max_threads();
+    const int d = std::min(p->get_depth(), 3);
+
+    std::vector<GLfloat> cache(w * h * 3, 0.0f);
+    std::vector<double>  busy(n, 0.0);
+    std::vector<int>     rows(n, 0);
+
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+
+    p->prepare();
+
+    int r;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (r = 0; r < h; ++r)
+    {
+        struct timeval tr;
+        gettimeofday(&tr, 0);
+
+        cache_row(p, &s, &cache.front(), w, h, r, d);
+
+        busy[omp_get_thread_num()] += getsecsince(&tr);
+        rows[omp_get_thread_num()] += 1;
+    }
+
+    const double t = getsecsince(&tv);
+
+    // Store the cache as a 3-channel float image.
+
+    rawf file(name, 0, h, w, 3, true, 'p');
+
+    for         (int i = 0; i < h; ++i)
+        for     (int j = 0; j < w; ++j)
+            for (int k = 0; k < 3; ++k)
+                file.put(i, j, k, cache[(i * w + j) * 3 + k]);
+
+    // Report the totals and the share of the work done by each thread.
+
+    const double m = *std::max_element(busy.begin(), busy.end());
+    const double a = std::accumulate(busy.begin(), busy.end(), 0.0) / n;
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "Rendered " << h << " x " << w << " x " << d
+              << " at (" << s.y << ", " << s.x << ") zoom " << s.z
+              << " to " << name << std::endl
+              << "Wall time " << t << " s, "
+              << std::setprecision(0) << double(h) * w * d / t
+              << " samples/s" << std::endl;
+
+    for (int i = 0; i < n; ++i)
+        std::cout << "Thread " << i << ": " << rows[i] << " rows, "
+                  << std::setprecision(3) << busy[i] << " s" << std::endl;
+
+    std::cout << "Balance " << std::setprecision(3) << (m ? a / m : 1.0)
+              << " (mean / max busy time)" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+
 int main(int argc, char **argv)
 {
     try
     {
+        char  *b = 0;
+        char  *r = 0;
+        char  *s = 0;
         bool   n = false;
+        int    d = -1;
         int    h = 512;
         int    w = 1024;
         double x = 0;
@@ -1055,10 +1862,15 @@ int main(int argc, char **argv)
 
         int c;
 
-        while ((c = getopt(argc, argv, "h:nw:x:y:z:")) != -1)
+        while ((c = getopt(argc, argv, "b:d:h:i:np:r:w:x:y:z:")) != -1)
             switch (c)
             {
+                case 'b': b = optarg;               break;
+                case 'd': d = strtol(optarg, 0, 0); break;
+                case 'i': raw::backend = optarg[0]; break;
                 case 'n': n = true;                 break;
+                case 'p': s = optarg;               break;
+                case 'r': r = optarg;               break;
                 case 'h': h = strtol(optarg, 0, 0); break;
                 case 'w': w = strtol(optarg, 0, 0); break;
                 case 'x': x = strtod(optarg, 0);    break;
@@ -1066,13 +1878,34 @@ int main(int argc, char **argv)
                 case 'z': z = strtod(optarg, 0);    break;
             }
 
+        if (d >= 0)
+            output::ceiling = size_t(d) << 20;
+
+        if (!strchr("mrd", raw::backend))
+            throw std::runtime_error("Unknown I/O backend: " + std::string(1, raw::backend));
+
+        // Batch processing sweeps its files from top to bottom while preview
+        // samples them sparsely and prefetches what it needs. Staged bands
+        // rotate with each advice, which preview issues concurrently with
+        // sampling, so preview, benchmark, and replay use only the mapping.
+
+        raw::pattern = n ? MADV_SEQUENTIAL : MADV_RANDOM;
+
+        if (!n && raw::backend != 'm')
+            throw std::runtime_error("I/O backends other than the mapping "
+                                     "require batch processing (-n)");
+
         if (image *p = parse_image(optind, argv))
         {
             if (n)
                 p->process();
+            else if (b)
+                bench(p, b, h, w, x, y, z);
+            else if (s)
+                play(p, s);
             else
             {
-                rawk app(p, h, w, x, y, z);
+                rawk app(p, h, w, x, y, z, r);
                 app.run(true);
             }
         }
@@ -0,0 +1,27 @@
+#version 150
+
+uniform sampler2D Image;
+uniform sampler2D Cost;
+
+in  vec2 fTexCoord;
+out vec4 fColor;
+
+const float tile = 16.0;
+
+vec3 heat(float k)
+{
+    return clamp(vec3(k * 3.0, k * 3.0 - 1.0, k * 3.0 - 2.0), 0.0, 1.0);
+}
+
+void main()
+{
+	vec2 bound = step(vec2(0.), fTexCoord) * step(fTexCoord, vec2(1.));
+	vec4 color = texture(Image, fTexCoord) * bound.x * bound.y;
+
+	vec2 scale = vec2(textureSize(Image, 0)) / (tile * vec2(textureSize(Cost, 0)));
+	float cost = texture(Cost, fTexCoord * scale).r * bound.x * bound.y;
+
+	float luma = dot(color.rgb, vec3(0.299, 0.587, 0.114));
+
+	fColor = vec4(mix(vec3(luma), heat(cost), 0.6), 1.0);
+}
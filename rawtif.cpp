@@ -66,6 +66,14 @@ void rawclose(int *d, uint8_t *p, size_t l)
         syserr();
 }
 
+// Return the number of bytes in a row of n samples of b bits. Rows of 1-bit
+// samples are padded to a whole byte, matching rawk's m type.
+
+size_t rowlen(size_t n, size_t b)
+{
+    return (n * b + 7) / 8;
+}
+
 int extcmp(const char *name, const char *ext)
 {
     return strcasecmp(name + strlen(name) - strlen(ext), ext);
@@ -86,8 +94,8 @@ void tif2raw(const char *in, const char *out)
         TIFFGetField(T, TIFFTAG_SAMPLESPERPIXEL, &c);
         TIFFGetField(T, TIFFTAG_BITSPERSAMPLE,   &b);
 
-        size_t p = size_t(c * b / 8);
-        size_t l = size_t(w * h * p);
+        size_t r = rowlen(size_t(w) * c, b);
+        size_t l = size_t(h) * r;
 
         int d = 0;
 
@@ -109,15 +117,16 @@ void tif2raw(const char *in, const char *out)
                     if (TIFFReadTile(T, src, x, y, 0, 0) > 0)
                     {
                         for (size_t i = 0; i < H; i++)
-                            memcpy(dst + p * ((y + i) * w + x),
-                                   src + p * ((    i) * W), W * p);
+                            memcpy(dst + (y + i) * r + rowlen(x * c, b),
+                                   src + (    i) * rowlen(W * c, b),
+                                                   rowlen(W * c, b));
                     }
                 }
             }
             else
             {
                 for (size_t i = 0; i < h; i++)
-                    TIFFReadScanline(T, dst + i * w * p, i, 0);
+                    TIFFReadScanline(T, dst + i * r, i, 0);
             }
             rawclose(&d, dst, l);
         }
@@ -127,8 +136,8 @@ void tif2raw(const char *in, const char *out)
 
 void raw2tif(const char *in, const char *out, uint32 h, uint32 w, uint16 c, uint16 b, uint16 f)
 {
-    size_t p = size_t(c * b / 8);
-    size_t l = size_t(w * h * p);
+    size_t r = rowlen(size_t(w) * c, b);
+    size_t l = size_t(h) * r;
 
     int d = 0;
 
@@ -149,7 +158,7 @@ void raw2tif(const char *in, const char *out, uint32 h, uint32 w, uint16 c, uint
                 TIFFSetField(T, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
 
             for (uint32 i = 0; i < h; i++)
-                TIFFWriteScanline(T, src + p * w * i, i, 0);
+                TIFFWriteScanline(T, src + r * i, i, 0);
 
             TIFFClose(T);
         }
@@ -175,7 +184,9 @@ int main(int argc, char **argv)
                               "height width channels bitdepth format\n"
                               "\t\tformat 1: unsigned integer\n"
                               "\t\tformat 2: signed integer\n"
-                              "\t\tformat 3: floating point\n",
+                              "\t\tformat 3: floating point\n"
+                              "\t\tbitdepth 16, format 3: half (type h)\n"
+                              "\t\tbitdepth 1, format 1: mask (type m)\n",
                               argv[0], argv[0]);
     return 0;
 }